@@ -37,6 +37,7 @@
 
 #include <packet.h>
 #include <list>
+#include <vector>
 #include "antnet_common.h"
 
 /// Forward ant identifier
@@ -47,37 +48,252 @@
 #define ANT_SIZE 7
 /// Macro to access ant header
 #define HDR_ANT_PKT(p) hdr_ant_pkt::access(p)
+/// Initial number of entries of an ant memory (grows as needed)
+#define ANT_MEM_INIT 16
+/// Initial number of slots in the visited set of an ant (power of 2)
+#define ANT_SEEN_INIT 32
+/// Maximum number of destinations of a forward ant
+#define MAX_ANT_TARGETS 16
+/// Drop reason for ants whose memory was reclaimed
+#define DROP_ANT_MEMORY "AMEM"
+
+/// Node addresses in ant memory are stored in 16 bits if ANT_MEM_NODE16 is defined (at most 65536 nodes)
+#ifdef ANT_MEM_NODE16
+typedef u_int16_t ant_node_t;
+#define ANT_MEM_PACKED __attribute__((packed))
+#else
+typedef u_int32_t ant_node_t;
+#define ANT_MEM_PACKED
+#endif
+/// Largest trip time that can be stored in ant memory, in microseconds
+#define ANT_MAX_TRIP_US 0xffffffffU
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 /// \brief Represents memory of an ant
 ///
 /// This structure represents memory of an ant that stores id and trip time of nodes visited by forward ant.
+/// Entries are compact: trip time (since pkt_start_time_) is stored in whole microseconds and node
+/// address in 32 (or 16) bits. Fields are read and written through accessors.
 ////////////////////////////////////////////////////////////////////////////////////////////////
 struct memory{
-	nsaddr_t node_addr;	///< node address
-	double trip_time;	///< trip time to node
+	ant_node_t node_;	///< node address
+	u_int32_t trip_us_;	///< trip time to node (microseconds)
+	
+	inline nsaddr_t node_addr() const {return (nsaddr_t)node_;}
+	inline double trip_time() const {return trip_us_ * 1e-6;}
+	inline void set_trip_time(double tt) {
+		double us = tt * 1e6 + 0.5;
+		trip_us_ = (us <= 0.0) ? 0 : (us >= ANT_MAX_TRIP_US) ? ANT_MAX_TRIP_US : (u_int32_t)us;
+	}
+	inline void set(nsaddr_t addr, double tt) {
+		node_ = (ant_node_t)addr;
+		set_trip_time(tt);
+	}
+} ANT_MEM_PACKED;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief Pool of ant memories
+///
+/// Ant memories are kept out of the packet header, so that their length is not bounded and
+/// packets do not carry unused memory in their header. The header only holds a handle
+/// (index and generation of a pool entry) and the length of the memory.
+/// Entries of ants freed by Antnet go back to the pool. Entries of ants dropped elsewhere
+/// (e.g. by queues) are reclaimed once they have not been touched for a lease period;
+/// releasing an entry bumps its generation, so stale handles are detected.
+////////////////////////////////////////////////////////////////////////////////////////////////
+class ant_memory_pool {
+	/// pool entry
+	struct entry {
+		std::vector<struct memory> mem;	///< memory of the ant (capacity is reused)
+		std::vector<nsaddr_t> seen;	///< visited set: open-addressing table of node addresses (-1 if empty)
+		std::vector<int> seen_pos;	///< position in memory of each node of the visited set
+		std::vector<nsaddr_t> targets;	///< destinations of a multi-destination forward ant
+		std::vector<nsaddr_t> excluded;	///< dead-end nodes a backtracking ant does not go to again
+		int seen_count;			///< number of occupied slots of the visited set
+		u_int32_t gen;			///< generation, incremented on release
+		double stamp;			///< time the entry was last accessed
+		bool used;			///< entry is attached to an ant
+		entry() : seen_count(0), gen(0), stamp(0.0), used(false) {}
+	};
+	std::vector<entry> entries_;	///< pool entries
+	std::vector<u_int32_t> free_;	///< indices of free entries
+	unsigned int sweep_size_;	///< pool size at which unused entries are next reclaimed
+	double lease_;			///< time after which an untouched entry is reclaimed
+	
+	ant_memory_pool() : sweep_size_(64), lease_(10.0) {}
+	void sweep();			///< reclaim entries not touched for lease period
+	void grow_seen(entry &e, int size);	///< double visited set, keeping nodes still in memory
+	/// returns slot of node in visited set, or the empty slot where it would go
+	inline static int seen_slot(const entry &e, nsaddr_t node) {
+		int mask = e.seen.size() - 1;
+		int i = ((u_int32_t)node * 2654435761U) & mask;
+		while(e.seen[i] != node && e.seen[i] != -1) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+	
+	public:
+		/// returns the pool shared by all Antnet agents
+		static ant_memory_pool& instance();
+		/// sets time after which an untouched entry is reclaimed
+		inline void set_lease(double lease) {lease_ = lease;}
+		/// allocates an entry, returns its index and generation
+		void alloc(u_int32_t &id, u_int32_t &gen);
+		/// returns an entry to the pool
+		void release(u_int32_t id, u_int32_t gen);
+		/// returns memory of an entry, with room for at least size entries (NULL if stale handle)
+		inline struct memory* access(u_int32_t id, u_int32_t gen, int size) {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+				return NULL;
+			entry &e = entries_[id];
+			if((int)e.mem.size() < size || e.mem.empty()) {
+				int cap = (e.mem.empty()) ? ANT_MEM_INIT : 2 * e.mem.size();
+				e.mem.resize(size > cap ? size : cap);
+			}
+			e.stamp = CURRENT_TIME;
+			return &e.mem[0];
+		}
+		/// returns position of node in the first size entries of memory, -1 if not visited
+		// Positions are not removed when memory is truncated, they are checked against memory instead
+		inline int visited(u_int32_t id, u_int32_t gen, nsaddr_t node, int size) const {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+				return -1;
+			const entry &e = entries_[id];
+			int pos = e.seen_pos[seen_slot(e, node)];
+			if(pos < 0 || pos >= size || e.mem[pos].node_addr() != node)
+				return -1;
+			return pos;
+		}
+		/// returns destinations of an entry (NULL if stale handle)
+		inline const nsaddr_t* targets(u_int32_t id, u_int32_t gen) const {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used || entries_[id].targets.empty())
+				return NULL;
+			return &entries_[id].targets[0];
+		}
+		/// sets destinations of an entry
+		inline void set_targets(u_int32_t id, u_int32_t gen, const nsaddr_t *targets, int n) {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+				return;
+			entries_[id].targets.assign(targets, targets + n);
+		}
+		/// returns dead-end nodes of an entry and their number (NULL if none or stale handle)
+		inline const nsaddr_t* excluded(u_int32_t id, u_int32_t gen, int &n) const {
+			n = 0;
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used || entries_[id].excluded.empty())
+				return NULL;
+			n = entries_[id].excluded.size();
+			return &entries_[id].excluded[0];
+		}
+		/// adds a dead-end node to an entry
+		inline void exclude(u_int32_t id, u_int32_t gen, nsaddr_t node) {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+				return;
+			entries_[id].excluded.push_back(node);
+		}
+		/// removes all dead-end nodes of an entry
+		inline void clear_excluded(u_int32_t id, u_int32_t gen) {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+				return;
+			entries_[id].excluded.clear();
+		}
+		/// records position of node in memory, size is the memory size after the node was added
+		inline void visit(u_int32_t id, u_int32_t gen, nsaddr_t node, int pos, int size) {
+			if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+				return;
+			entry &e = entries_[id];
+			int i = seen_slot(e, node);
+			if(e.seen[i] == -1) {
+				if(2 * (e.seen_count + 1) > (int)e.seen.size()) {
+					grow_seen(e, size);	// keep load below 1/2
+					i = seen_slot(e, node);
+				}
+				e.seen[i] = node;
+				e.seen_count++;
+			}
+			e.seen_pos[i] = pos;
+		}
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 /// \brief Ant packet header
 ////////////////////////////////////////////////////////////////////////////////////////////////
 struct hdr_ant_pkt {
-        u_int8_t pkt_type_;	///< Packet Type (forward/backward)
+	// fields ordered by size to avoid padding
+	double pkt_start_time_;	///< packet start time
 	nsaddr_t pkt_src_;	///< address of source node (which originated the packet)
 	nsaddr_t pkt_dst_;	///< address of destination node
+	u_int32_t pkt_mem_id_;	///< pool entry holding packet's memory
+	u_int32_t pkt_mem_gen_;	///< generation of pool entry
+	float pkt_budget_;	///< trip time after which forward ant is terminated (0: no limit)
 	u_int16_t pkt_len_;	///< packet length
+	u_int16_t pkt_mem_size_;	///< size of memory
+	u_int16_t pkt_mem_cur_;	///< position in memory of node holding backward ant
+        u_int8_t pkt_type_;	///< Packet Type (forward/backward)
 	u_int8_t pkt_seq_num_;	///< packet sequence number
-	double pkt_start_time_;	///< packet start time
-	struct memory pkt_memory_[MAX_NUM_NODES];	///< packet's memory
-	int pkt_mem_size_;	///< size of memory
+	u_int8_t pkt_num_targets_;	///< number of destinations of forward ant (kept in pool if more than 1)
+	u_int8_t pkt_target_;	///< index of current destination (pkt_dst_) among them
+	u_int8_t pkt_backtracks_;	///< number of times forward ant went back from a dead end
 	
 	inline nsaddr_t& pkt_src() {return pkt_src_;}
 	inline nsaddr_t& pkt_dst() {return pkt_dst_;}
 	inline u_int16_t& pkt_len() {return pkt_len_;}
 	inline u_int8_t& pkt_seq_num() {return pkt_seq_num_;}
 	inline double& pkt_start_time() {return pkt_start_time_;}
-	inline int& pkt_mem_size() {return pkt_mem_size_;}
+	inline float& pkt_budget() {return pkt_budget_;}
+	inline u_int16_t& pkt_mem_size() {return pkt_mem_size_;}
+	inline u_int16_t& pkt_mem_cur() {return pkt_mem_cur_;}
 	inline u_int8_t& pkt_type() {return pkt_type_;}
+	inline u_int8_t& pkt_num_targets() {return pkt_num_targets_;}
+	inline u_int8_t& pkt_target() {return pkt_target_;}
+	inline u_int8_t& pkt_backtracks() {return pkt_backtracks_;}
+	
+	/// attach a new (empty) memory from the pool
+	inline void alloc_memory() {
+		ant_memory_pool::instance().alloc(pkt_mem_id_, pkt_mem_gen_);
+		pkt_mem_size_ = 0;
+	}
+	/// return memory to the pool
+	inline void release_memory() {
+		ant_memory_pool::instance().release(pkt_mem_id_, pkt_mem_gen_);
+	}
+	/// packet's memory with room for size entries (NULL if memory was reclaimed)
+	inline struct memory* pkt_memory(int size) {
+		return ant_memory_pool::instance().access(pkt_mem_id_, pkt_mem_gen_, size);
+	}
+	/// packet's memory (NULL if memory was reclaimed)
+	inline struct memory* pkt_memory() {return pkt_memory(pkt_mem_size_);}
+	/// destinations of a multi-destination ant (NULL if memory was reclaimed)
+	inline const nsaddr_t* pkt_targets() const {
+		return ant_memory_pool::instance().targets(pkt_mem_id_, pkt_mem_gen_);
+	}
+	/// sets destinations of a multi-destination ant, first one is pkt_dst_
+	inline void pkt_set_targets(const nsaddr_t *targets, int n) {
+		ant_memory_pool::instance().set_targets(pkt_mem_id_, pkt_mem_gen_, targets, n);
+		pkt_num_targets_ = n;
+		pkt_target_ = 0;
+		pkt_dst_ = targets[0];
+	}
+	/// dead-end nodes of a backtracking ant and their number
+	inline const nsaddr_t* pkt_excluded(int &n) const {
+		return ant_memory_pool::instance().excluded(pkt_mem_id_, pkt_mem_gen_, n);
+	}
+	/// adds a dead-end node to a backtracking ant
+	inline void pkt_exclude(nsaddr_t node) {
+		ant_memory_pool::instance().exclude(pkt_mem_id_, pkt_mem_gen_, node);
+	}
+	/// forgets dead-end nodes (they hold for one destination only)
+	inline void pkt_clear_excluded() {
+		ant_memory_pool::instance().clear_excluded(pkt_mem_id_, pkt_mem_gen_);
+	}
+	/// position of node in packet's memory, -1 if not visited
+	inline int pkt_visited(nsaddr_t node) const {
+		return ant_memory_pool::instance().visited(pkt_mem_id_, pkt_mem_gen_, node, pkt_mem_size_);
+	}
+	/// record node added at position pos of packet's memory
+	inline void pkt_visit(nsaddr_t node, int pos) {
+		ant_memory_pool::instance().visit(pkt_mem_id_, pkt_mem_gen_, node, pos, pkt_mem_size_);
+	}
 		
 	static int offset_;
 	inline static int& offset() {return offset_;}
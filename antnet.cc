@@ -38,7 +38,6 @@
 
 int hdr_ant_pkt::offset_;	///< to access ant packet header
 extern double r;		///< reinforcement factor
-extern int N;			///< number of neighbors of a node
 extern int NUM_NODES;		///< total number of nodes in the topology
 
 ///////////////////////////////////////////////////////////////////////////
@@ -74,9 +73,30 @@ static class AntnetClass : public TclClass {
 	bind("num_nodes_y_", &num_nodes_y_);	// number of nodes in column (for regular mesh topology)
 	bind("r_factor_", &r_factor_);		// reinforcement factor
 	bind("timer_ant_", &timer_ant_);	// timer for generation of forward ants
+	bind_bool("queue_heuristic_", &queue_heuristic_);	// blend queue lengths into next hop choice
+	bind("queue_ewma_", &queue_ewma_);	// weight of averaged queue length
+	bind("fenwick_degree_", &fenwick_degree_);	// degree above which rtable rows use Fenwick trees
+	bind("mem_lease_", &mem_lease_);	// lease of ant memories lost outside Antnet
+	bind("ant_pool_max_", &ant_pool_max_);	// released ant packets kept for reuse
+	bind("kill_factor_", &kill_factor_);	// trip time budget of forward ants
+	bind_bool("dedup_", &dedup_);		// suppress forward ants to destinations with an ant in flight
+	bind("dedup_timeout_", &dedup_timeout_);	// longest time a forward ant is in flight
+	bind("ant_targets_", &ant_targets_);	// destinations of each forward ant
+	bind("max_backtracks_", &max_backtracks_);	// times a forward ant may go back from a dead end
+	bind("mem_entry_bytes_", &mem_entry_bytes_);	// bytes on the wire per ant memory entry
+	bind("win_len_", &win_len_);		// trip times kept in observation window per destination
+	bind_bool("adaptive_r_", &adaptive_r_);	// reinforcement factor from traffic model
+	bind_bool("trip_quantiles_", &trip_quantiles_);	// keep traffic model for trip time quantiles
+	bind("dest_floor_", &dest_floor_);	// share of destinations drawn uniformly with traffic weights
 	
 	ra_addr_ = id;		// agent address 
 	ant_seq_num_ = 0;	// initialize sequence number of ant packets to zero
+	node_ = NULL;
+	nb_epoch_ = -1;		// neighbor cache not built yet
+	ants_suppressed_ = 0;
+	ants_redrawn_ = 0;
+	fwd_pkts_ = bwd_pkts_ = 0;
+	fwd_bytes_ = bwd_bytes_ = 0;
 }
 
 /////////////////////////////////////////////////////////////////
@@ -85,7 +105,11 @@ static class AntnetClass : public TclClass {
 int Antnet::command(int argc, const char*const* argv) {
 	if (argc == 2) {
 		if(strcasecmp(argv[1], "start") == 0) {	// begin AntNet algorithm
+			build_neighbor_cache();	// cache neighbor nodes and queues of links to them
 			initialize_rtable();	// initialize routing tables
+			ant_memory_pool::instance().set_lease(mem_lease_);
+			ant_packet_pool::instance().set_max(ant_pool_max_);
+			traffic_.set_win_len(win_len_);
 			ant_timer_.resched(0.);	// schedule timer to begin ant generation now
 			return TCL_OK;
 		}
@@ -100,6 +124,21 @@ int Antnet::command(int argc, const char*const* argv) {
 			rtable_.print();	// call method to print routing table
 			return TCL_OK;
 		}
+		else if (strcasecmp(argv[1], "ant-overhead") == 0) {	// ants and bytes sent by this agent
+			Tcl::instance().resultf("forward_pkts %.0f forward_bytes %.0f backward_pkts %.0f backward_bytes %.0f",
+				fwd_pkts_, fwd_bytes_, bwd_pkts_, bwd_bytes_);
+			return TCL_OK;
+		}
+		else if (strcasecmp(argv[1], "dedup-stats") == 0) {	// counters of in-flight deduplication
+			Tcl::instance().resultf("suppressed %d redrawn %d", ants_suppressed_, ants_redrawn_);
+			return TCL_OK;
+		}
+		else if (strcasecmp(argv[1], "ant-pool-stats") == 0) {	// statistics of ant packet pool
+			char buf[256];
+			ant_packet_pool::instance().stats(buf, sizeof(buf));
+			Tcl::instance().result(buf);
+			return TCL_OK;
+		}
  	}
 	else if (argc == 3) {
 		// obtain corresponding dmux to carry packets
@@ -111,6 +150,51 @@ int Antnet::command(int argc, const char*const* argv) {
  			}
 			return TCL_OK;
  		}
+		// trip time quantiles from this node to a destination
+		else if (strcmp(argv[1], "trip-quantiles") == 0) {
+			if(!keep_traffic()) {
+				Tcl::instance().resultf("%s: traffic model is off, set trip_quantiles_ true", argv[1]);
+				return TCL_ERROR;
+			}
+			const struct traffic_matrix *m = traffic_.find(atoi(argv[2]));
+			const trip_quantiles *tq = traffic_.quantiles(atoi(argv[2]));
+			if(m == NULL)
+				Tcl::instance().result("count 0");
+			else
+				Tcl::instance().resultf("count %d p50 %f p95 %f p99 %f", m->count, tq->p50.value(), tq->p95.value(), tq->p99.value());
+			return TCL_OK;
+		}
+		// traffic weights of destinations from a file of "destination weight" lines
+		else if (strcmp(argv[1], "dest-weights") == 0) {
+			FILE *fp = fopen(argv[2], "r");
+			if(fp == NULL) {
+				fprintf(stderr, "%s: %s cannot open %s\n",__FILE__,argv[1],argv[2]);
+				return TCL_ERROR;
+			}
+			int dest, line = 0;
+			double weight;
+			char buf[256];
+			while(fgets(buf, sizeof(buf), fp) != NULL) {
+				line++;
+				char tail;
+				int n = sscanf(buf, "%d %lf %c", &dest, &weight, &tail);
+				if(n == EOF)	// blank line
+					continue;
+				if(n != 2) {
+					Tcl::instance().resultf("%s: %s line %d: expected \"destination weight\"", argv[1], argv[2], line);
+					fclose(fp);
+					return TCL_ERROR;
+				}
+				if(dest < 0 || dest >= num_nodes_) {
+					Tcl::instance().resultf("%s: %s line %d: destination %d out of range (0 to %d)", argv[1], argv[2], line, dest, num_nodes_ - 1);
+					fclose(fp);
+					return TCL_ERROR;
+				}
+				rtable_.set_dest_weight(dest, weight);
+			}
+			fclose(fp);
+			return TCL_OK;
+		}
 		// obtain corresponding tracer
 		else if (strcmp(argv[1], "log-target") == 0 || strcmp(argv[1], "tracetarget") == 0) {
 			logtarget_ = (Trace*)TclObject::lookup(argv[2]);
@@ -127,6 +211,21 @@ int Antnet::command(int argc, const char*const* argv) {
 			add_Neighbor(node1, node2);
 			return TCL_OK;
 		}
+		// traffic weight of a destination, ants are sent by weight
+		else if(strcmp(argv[1], "dest-weight") == 0) {
+			int dest;
+			double weight;
+			if(sscanf(argv[2], "%d", &dest) != 1 || sscanf(argv[3], "%lf", &weight) != 1) {
+				Tcl::instance().resultf("%s: expected \"destination weight\", got \"%s %s\"", argv[1], argv[2], argv[3]);
+				return TCL_ERROR;
+			}
+			if(dest < 0 || dest >= num_nodes_) {
+				Tcl::instance().resultf("%s: destination %d out of range (0 to %d)", argv[1], dest, num_nodes_ - 1);
+				return TCL_ERROR;
+			}
+			rtable_.set_dest_weight(dest, weight);
+			return TCL_OK;
+		}
 	}
  	// Pass the command to the base class
 	return Agent::command(argc, argv);
@@ -143,7 +242,7 @@ void Antnet::recv(Packet *p, Handler *h) {
 	if((int)ih->saddr() == ra_addr()) {
 		// If loop, drop the packet
 		if (ch->num_forwards() > 0) {
-			drop(p, DROP_RTR_ROUTE_LOOP);
+			drop_ant(p, DROP_RTR_ROUTE_LOOP);
 		}
 		// else if reciever is the source
 		else if (ch->num_forwards() == 0){
@@ -169,33 +268,43 @@ void Antnet::recv(Packet *p, Handler *h) {
 /////////////////////////////////////////////////////////////////
 void Antnet::send_ant_pkt() {
 	nsaddr_t next, dest;
-	Packet* p = allocpkt();			// allocate new packet
+	check_neighbor_cache();
+	dest = pick_destination();		// generate random destination
+	if(dest < 0)				// ants in flight to all drawn destinations
+		return;
+	Packet* p = alloc_ant();		// allocate new packet
 	struct hdr_cmn* ch = HDR_CMN(p);	// common header
 	struct hdr_ip* ih = HDR_IP(p);		// ip header
 	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);// ant header
 	
 	ah->pkt_type() = FORWARD_ANT;		// set ant type as FORWARD ant
 	ah->pkt_src() = addr();			// source address
-	ah->pkt_len() = ANT_SIZE;		// length of ant header
 	ah->pkt_seq_num() = ant_seq_num_++;	// sequence number
 	ah->pkt_start_time() = CURRENT_TIME;	// packet generation time
-	dest = rtable_.calc_destination(addr());// generate random destination
 	ah->pkt_dst() = dest;			// set packet destination
-	ah->pkt_mem_size() = 0;			// initialize size of memory
-	ah->pkt_memory_[0].node_addr = addr();	// add source node to memory
-	ah->pkt_memory_[0].trip_time = 0.0;	// add trip time to this node to memory
-	ah->pkt_mem_size()++;			// increment size of memory
+	ah->alloc_memory();			// attach empty memory from pool
+	ah->pkt_num_targets() = 1;		// single destination
+	ah->pkt_target() = 0;
+	ah->pkt_backtracks() = 0;
+	if(ant_targets_ > 1)
+		pick_targets(p);		// more destinations, kept with memory
+	struct memory* mem = ah->pkt_memory(1);
+	mem[0].set(addr(), 0.0);		// add source node and trip time to this node to memory
+	ah->pkt_mem_size() = 1;			// size of memory
+	ah->pkt_mem_cur() = 0;			// cursor is used by backward ant
+	ah->pkt_budget() = 0.0;			// no trip time budget unless destination is known
+	if(kill_factor_ > 0.0) {
+		const struct traffic_matrix *m = traffic_.find(dest);
+		if(m != NULL)
+			ah->pkt_budget() = kill_factor_ * m->mean_tt;
+	}
 		
-	ch->ptype() = PT_ANT;			// set packet type as Ant
 	ch->direction() = hdr_cmn::DOWN;	// forward ant
-	ch->size() = IP_HDR_LEN + ah->pkt_len();// packet header size
-	ch->error() = 0;
-	ch->addr_type() = NS_AF_INET;
 	// generate next hop as per AntNet algorithm
-	next = rtable_.calc_next(addr(), ah->pkt_dst(), addr());
+	next = rtable_.calc_next(addr(), ah->pkt_dst(), addr(), queue_occupancy());
 	// if next hop same as this node, release packet
 	if(next == addr()) {
-		Packet::free(p);
+		free_ant(p);
 		return;
 	}
 	ch->next_hop() = next;		// set next hop address in common header
@@ -206,7 +315,141 @@ void Antnet::send_ant_pkt() {
 	if(DEBUG)
 		fprintf(stdout,"sending antnet packet from %d to %d next hop %d\n", ah->pkt_src(), ah->pkt_dst(), ih->daddr());
 	
-	target_->recv(p);	// send forward ant packet
+	if(dedup_) {
+		// ant is in flight for its estimated round trip time, at most dedup_timeout_
+		double timeout = dedup_timeout_;
+		const struct traffic_matrix *m = traffic_.find(dest);
+		if(m != NULL && 2 * m->mean_tt < timeout)
+			timeout = 2 * m->mean_tt;
+		const nsaddr_t *targets = (ah->pkt_num_targets() > 1) ? ah->pkt_targets() : &dest;
+		for(int i = 0; i < ah->pkt_num_targets(); i++) {
+			if(targets[i] >= (nsaddr_t)inflight_.size())
+				inflight_.resize(targets[i] + 1, 0.0);
+			inflight_[targets[i]] = CURRENT_TIME + timeout;
+		}
+	}
+	send_ant(p);	// send forward ant packet
+}
+
+/////////////////////////////////////////////////////////////////
+/// Method to draw destination of a forward ant
+/// With dedup_ set, destinations with an ant in flight are drawn
+/// again, up to DEDUP_DRAWS draws, then the ant is suppressed
+/////////////////////////////////////////////////////////////////
+nsaddr_t Antnet::pick_destination() {
+	nsaddr_t dest = rtable_.calc_destination(addr());
+	if(!dedup_)
+		return dest;
+	for(int draw = 1; in_flight(dest); draw++) {
+		if(draw == DEDUP_DRAWS) {
+			ants_suppressed_++;
+			return -1;
+		}
+		ants_redrawn_++;
+		dest = rtable_.calc_destination(addr());
+	}
+	return dest;
+}
+
+/////////////////////////////////////////////////////////////////
+/// Method to check if a forward ant to a destination is in flight
+/////////////////////////////////////////////////////////////////
+bool Antnet::in_flight(nsaddr_t dest) const {
+	return dedup_ && dest < (nsaddr_t)inflight_.size() && inflight_[dest] > CURRENT_TIME;
+}
+
+/////////////////////////////////////////////////////////////////
+/// Method to draw destinations of a multi-destination forward ant
+/// First destination is pkt_dst_, others are distinct and not in
+/// flight. Up to 2 * ant_targets_ draws are made.
+/////////////////////////////////////////////////////////////////
+void Antnet::pick_targets(Packet* p) {
+	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
+	int n = (ant_targets_ < MAX_ANT_TARGETS) ? ant_targets_ : MAX_ANT_TARGETS;
+	targets_.clear();
+	targets_.push_back(ah->pkt_dst());
+	for(int draw = 0; draw < 2 * n && (int)targets_.size() < n; draw++) {
+		nsaddr_t dest = rtable_.calc_destination(addr());
+		if(in_flight(dest) || std::find(targets_.begin(), targets_.end(), dest) != targets_.end())
+			continue;
+		targets_.push_back(dest);
+	}
+	if(targets_.size() > 1)
+		ah->pkt_set_targets(&targets_[0], targets_.size());
+}
+
+/////////////////////////////////////////////////////////////////
+/// Method to move a forward ant that reached its destination on
+/// to its next destination not yet in its memory.
+/// Returns false if there is none (backward ant is created).
+/////////////////////////////////////////////////////////////////
+bool Antnet::next_target(Packet* p) {
+	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
+	if(ah->pkt_target() + 1 >= ah->pkt_num_targets())
+		return false;
+	const nsaddr_t *targets = ah->pkt_targets();
+	if(targets == NULL)
+		return false;
+	for(int i = ah->pkt_target() + 1; i < ah->pkt_num_targets(); i++) {
+		if(ah->pkt_visited(targets[i]) >= 0)
+			continue;	// visited on the way to an earlier destination
+		ah->pkt_target() = i;
+		ah->pkt_dst() = targets[i];
+		ah->pkt_clear_excluded();	// dead ends were dead ends towards previous destination
+		if(kill_factor_ > 0.0) {
+			// budget for next leg from trip time so far and local estimate
+			const struct traffic_matrix *m = traffic_.find(targets[i]);
+			if(m != NULL)
+				ah->pkt_budget() = (CURRENT_TIME - ah->pkt_start_time()) + kill_factor_ * m->mean_tt;
+			else
+				ah->pkt_budget() = 0.0;
+		}
+		return true;
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////
+/// Method to allocate a forward ant
+/// A packet from the pool already carries the fields common to all
+/// ants, only the fields that change from ant to ant, and the ip and
+/// flags fields Agent::initpkt() sets, are set again
+///////////////////////////////////////////////////////////////////
+Packet* Antnet::alloc_ant() {
+	Packet* p = ant_packet_pool::instance().get();
+	if(p == NULL) {
+		p = allocpkt();			// allocate new packet
+		struct hdr_cmn* ch = HDR_CMN(p);
+		ch->ptype() = PT_ANT;		// set packet type as Ant
+		ch->addr_type() = NS_AF_INET;
+		return p;
+	}
+	struct hdr_cmn* ch = HDR_CMN(p);
+	ch->uid() = uidcnt_++;			// new unique id
+	ch->timestamp() = CURRENT_TIME;
+	ch->iface() = UNKN_IFACE.value();
+	ch->error() = 0;
+	ch->num_forwards() = 0;
+	// ip and flags fields as set by Agent::initpkt()
+	struct hdr_ip* ih = HDR_IP(p);
+	ih->saddr() = here_.addr_;
+	ih->sport() = here_.port_;
+	ih->daddr() = dst_.addr_;
+	ih->dport() = dst_.port_;
+	ih->flowid() = fid_;
+	ih->prio() = prio_;
+	ih->ttl() = defttl_;
+	hdr_flags* hf = hdr_flags::access(p);
+	hf->ecn_capable_ = 0;
+	hf->ecn_ = 0;
+	hf->eln_ = 0;
+	hf->ecn_to_echo_ = 0;
+	hf->fs_ = 0;
+	hf->no_ts_ = 0;
+	hf->pri_ = 0;
+	hf->cong_action_ = 0;
+	hf->qs_ = 0;
+	return p;
 }
 
 ///////////////////////////////////////////////////////////////////
@@ -224,14 +467,29 @@ void Antnet::recv_ant_pkt(Packet* p) {
 	if(DEBUG)
 		printf("In recv_antnet_pkt() %d at node %d %d source %d dest %d\n", ch->direction(), addr(), ih->daddr(), ah->pkt_src(), ah->pkt_dst());
 	
+	// memory reclaimed by pool, ant is of no use
+	if(ah->pkt_memory() == NULL) {
+		drop(p, DROP_ANT_MEMORY);
+		return;
+	}
+	
 	if(ch->direction() == hdr_cmn::DOWN) {	// forward ant
 		if(addr() == ah->pkt_dst()) {	// destination node
 			// add this node to memory
 			memorize(p);
+			// go on to next destination of a multi-destination ant
+			if(next_target(p))
+				forward_ant_pkt(p);
 			// create backward ant
-			create_backward_ant_pkt(p);
+			else
+				create_backward_ant_pkt(p);
 		}
 		else {		// not destination node
+			// ant cannot bring back a useful trip time, terminate it
+			if(over_budget(p)) {
+				free_ant(p);
+				return;
+			}
 			// add this node to memory
 			memorize(p);
 			// send forward ant to next hop node as determined by AntNet algorithm
@@ -240,14 +498,21 @@ void Antnet::recv_ant_pkt(Packet* p) {
 	}
 	else 	if(ch->direction() == hdr_cmn::UP) {	// backward ant
 		if(addr() == ah->pkt_dst()) {	// destination node, travel complete
-			// update routing table
+			// ants to these destinations are no longer in flight
+			const nsaddr_t *targets = (ah->pkt_num_targets() > 1) ? ah->pkt_targets() : NULL;
+			for(int i = 0; i < ah->pkt_num_targets(); i++) {
+				nsaddr_t dest = (targets != NULL) ? targets[i] : ah->pkt_src();
+				if(dest < (nsaddr_t)inflight_.size())
+					inflight_[dest] = 0.0;
+			}
+			// update routing table (and traffic model)
 			update_table(p);
 			// release packet
-			Packet::free(p);
+			free_ant(p);
 			return;
 		}
 		else {		// not destination node
-			// update routing table
+			// update routing table (and traffic model)
 			update_table(p);
 			// send backward ant to next hop node as determined by memory
 			backward_ant_pkt(p);
@@ -260,25 +525,26 @@ void Antnet::recv_ant_pkt(Packet* p) {
 ///////////////////////////////////////////////////////////////////
 void Antnet::memorize(Packet* p) {
 	struct hdr_ant_pkt* tmp = HDR_ANT_PKT(p);	// ant header
+	// memory with room for this node
+	struct memory* mem = tmp->pkt_memory(tmp->pkt_mem_size()+1);
 	
 	double time = CURRENT_TIME - tmp->pkt_start_time();	// trip time to this node
 	
 	// If node revisited, there is a loop, remove loop and corresponding memory
-	for(int i=0; i<tmp->pkt_mem_size(); i++) {
-		if(tmp->pkt_memory_[i].node_addr == addr()) {
-			double t = time - tmp->pkt_memory_[i].trip_time;
-			tmp->pkt_mem_size() = i+1;
-			for(int j=0; j <= i; j++) {
-				tmp->pkt_memory_[j].trip_time += t;
-			}
-			return;
+	int i = tmp->pkt_visited(addr());
+	if(i >= 0) {
+		double t = time - mem[i].trip_time();
+		tmp->pkt_mem_size() = i+1;
+		for(int j=0; j <= i; j++) {
+			mem[j].set_trip_time(mem[j].trip_time() + t);
 		}
+		return;
 	}
 	
 	// add current node to memory
-	tmp->pkt_memory_[tmp->pkt_mem_size()].node_addr = addr();
-	tmp->pkt_memory_[tmp->pkt_mem_size()].trip_time = time;
+	mem[tmp->pkt_mem_size()].set(addr(), time);
 	tmp->pkt_mem_size() = tmp->pkt_mem_size()+1;
+	tmp->pkt_visit(addr(), tmp->pkt_mem_size()-1);
 
 	if(DEBUG) {
 		fprintf(stdout,"adding %d to memory of pkt %d\n", addr(), tmp->pkt_seq_num());
@@ -293,12 +559,28 @@ void Antnet::forward_ant_pkt(Packet* p) {
 	struct hdr_cmn* ch = HDR_CMN(p);	// common header
 	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);// ant header
 
+	check_neighbor_cache();
 	nsaddr_t parent = ih->saddr();	// parent node
-	// find next hop node as per AntNet algorithm
-	nsaddr_t next = rtable_.calc_next(addr(), ah->pkt_dst(), parent);
-	// if next hop is this node or parent node, dead end, release packet
+	nsaddr_t next;
+	if(ah->pkt_backtracks() == 0) {
+		// find next hop node as per AntNet algorithm
+		next = rtable_.calc_next(addr(), ah->pkt_dst(), parent, queue_occupancy());
+	}
+	else {
+		// ant has backtracked, parent is the node before this one in memory
+		// and dead ends found so far are left out
+		struct memory* mem = ah->pkt_memory();
+		int size = ah->pkt_mem_size();
+		parent = (size >= 2) ? mem[size-2].node_addr() : addr();
+		int num_excluded;
+		const nsaddr_t *excluded = ah->pkt_excluded(num_excluded);
+		next = rtable_.calc_next(addr(), ah->pkt_dst(), parent, queue_occupancy(), excluded, num_excluded);
+	}
+	// if next hop is this node or parent node, dead end, go back or release packet
 	if(next == addr() || next == parent) {
-		Packet::free(p);
+		if(ah->pkt_backtracks() < max_backtracks_ && backtrack(p))
+			return;
+		free_ant(p);
 		return;
 	}
 	
@@ -308,7 +590,43 @@ void Antnet::forward_ant_pkt(Packet* p) {
 	if(DEBUG)
 		fprintf(stdout,"forwarding antnet packet from %d source %d dest %d next hop %d\n", addr(), ah->pkt_src(), ah->pkt_dst(), ih->daddr());
 	// send packet to next hop node
-	target_->recv(p);
+	send_ant(p);
+}
+
+//////////////////////////////////////////////////////////////////////////
+/// Method to send a forward ant back from a dead end
+/// This node is removed from memory and left out of the ant's next
+/// choices, the ant is sent to the node before it, which chooses again.
+/// Returns false if there is no node to go back to.
+//////////////////////////////////////////////////////////////////////////
+bool Antnet::backtrack(Packet* p) {
+	struct hdr_ip* ih = HDR_IP(p);
+	struct hdr_cmn* ch = HDR_CMN(p);
+	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
+	
+	int size = ah->pkt_mem_size();
+	if(size < 2 || ah->pkt_memory()[size-1].node_addr() != addr() || ah->pkt_backtracks() == 255)
+		return false;
+	nsaddr_t prev = ah->pkt_memory()[size-2].node_addr();
+	ah->pkt_mem_size() = size-1;	// pop this node from memory
+	// do not come here again, unless this node is a destination still to be reached
+	bool pending = false;
+	const nsaddr_t *targets = (ah->pkt_num_targets() > 1) ? ah->pkt_targets() : NULL;
+	for(int i = ah->pkt_target(); targets != NULL && i < ah->pkt_num_targets(); i++) {
+		if(targets[i] == addr())
+			pending = true;
+	}
+	if(!pending && addr() != ah->pkt_dst())
+		ah->pkt_exclude(addr());
+	ah->pkt_backtracks()++;
+	
+	ch->next_hop() = prev;
+	ih->saddr() = addr();
+	ih->daddr() = prev;
+	if(DEBUG)
+		fprintf(stdout,"backtracking antnet packet from %d source %d dest %d to %d\n", addr(), ah->pkt_src(), ah->pkt_dst(), prev);
+	send_ant(p);
+	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -327,16 +645,17 @@ void Antnet::create_backward_ant_pkt(Packet* p) {
 	
 	// retrieve last second entry in memory (last entry is this node)
 	int index = ah->pkt_mem_size() - 2;
+	ah->pkt_mem_cur() = index;	// cursor at next hop node, moves back one entry per hop
 	ch->direction() = hdr_cmn::UP;	// chnge direction to backward Ant
 	ch->ptype() = PT_ANT;	// set packet type as Ant
-	ch->next_hop() = ah->pkt_memory_[index].node_addr;	// next hop as determined from memory
+	ch->next_hop() = ah->pkt_memory()[index].node_addr();	// next hop as determined from memory
 	ih->saddr() = addr();	// source address
 	ih->daddr() = ch->next_hop();	// destination address
 	
 	if(DEBUG)
 		fprintf(stdout,"creating backward antnet packet from %d source %d dest %d next hop %d\n", addr(), ah->pkt_src(), ah->pkt_dst(), ih->daddr());
 	// send backward ant packet
-	target_->recv(p);
+	send_ant(p);
 }
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -348,16 +667,17 @@ void Antnet::backward_ant_pkt(Packet* p) {
 	struct hdr_cmn* ch = HDR_CMN(p);
 	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
 	
-	// find node previous to this node in memory
-	int index;
-	for(int i = ah->pkt_mem_size()-1; i >= 0; i--) {
-		if(ah->pkt_memory_[i].node_addr == addr()) {
-			index = i-1;
-			break;
-		}
+	struct memory* mem = ah->pkt_memory();
+	
+	// node previous to this node in memory
+	int index = ah->pkt_mem_cur() - 1;
+	if(index < 0) {	// already at first node of memory
+		free_ant(p);
+		return;
 	}
+	ah->pkt_mem_cur() = index;
 	// next hop node determined from memory
-	ch->next_hop() = ah->pkt_memory_[index].node_addr;
+	ch->next_hop() = mem[index].node_addr();
 	ch->direction() = hdr_cmn::UP;	// backward ant
 	ch->ptype() = PT_ANT;	// packet type = Ant
 	ih->saddr() = addr();	// source address
@@ -366,120 +686,74 @@ void Antnet::backward_ant_pkt(Packet* p) {
 	if(DEBUG)
 		fprintf(stdout,"forwarding backward antnet packet from %d source %d dest %d next hop %d\n", addr(), ah->pkt_src(), ah->pkt_dst(), ih->daddr());
 	// send backward ant to next hop
-	target_->recv(p);
+	send_ant(p);
 }
 
 ///////////////////////////////////////////////////////////////
 /// Method to return size of observation window
 ///////////////////////////////////////////////////////////////
 int Antnet::get_win_size(nsaddr_t dest) {
-	int count = 0;
-	window_t::iterator iterWin = window_.find(dest);
-	triptime_t win_tt = (*iterWin).second;
-	triptime_t::iterator itertt;
-	for(itertt = win_tt.begin(); itertt != win_tt.end(); itertt++) {
-		count++;
-	}
-	return count;
+	return traffic_.win_size(dest);
 }
 
 ////////////////////////////////////////////////////////////////////////////
 /// Method to update traffic model and calculate reinforcement factor (r).
-/// Presently, constant value of r is used.
-/// Value of r can be set form tcl script.
-/// Hence, traffic model is not used and this method is not called.
+/// Parameters: destination node, trip time from this node to destination.
+/// Returns r for the destination, squashed as in AntNet so that it grows
+/// with the number of neighbors: r = s(r)/s(1), s(x) = 1/(1 + exp(a/(x*N))),
+/// at most MAX_ADAPTIVE_R.
+/// The r is used only with adaptive_r_; by default the constant r set
+/// from tcl script is used.
 ///////////////////////////////////////////////////////////////////////////
-void Antnet::update_traffic(Packet* p) {
-	//update mean, variance, best.
-	struct traffic_matrix temp_traffic;
-	nsaddr_t dest, next;
-	double tt, oldtt;
-	double oldvar;
-	double varsigma = VARSIGMA;
-	
-	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
-	int i;
-	for(i=0; ah->pkt_memory_[i].node_addr != addr(); i++);
-	double initialtt = ah->pkt_memory_[i].trip_time;
-	i++;
-	next = ah->pkt_memory_[i].node_addr;
-	
-	for(int index = i; index < ah->pkt_mem_size(); index++) {
-	
-				
-		dest = ah->pkt_memory_[index].node_addr;
-		tt = ah->pkt_memory_[index].trip_time - initialtt;
-		
-		/* update sample window */
-		window_t::iterator iterWin = window_.find(dest);
-		if(iterWin != window_.end()) {	// destination entry exists, add to it in window
-			(*iterWin).second.push_back(tt);
-		}
-		else {	// destination entry does not exist, add new dest entry to window
-			triptime_t win_tt;
-			win_tt.push_back(tt);
-			window_[dest] = win_tt;
-		}
-	}
+double Antnet::update_traffic(nsaddr_t dest, double tt) {
+	/* update sample window, mean, variance and best trip time */
+	const struct traffic_matrix &m = traffic_.update(dest, tt, VARSIGMA);
 	
-	/* update traffic */
-	for(int index = i; index < ah->pkt_mem_size(); index++) {
-		
-		dest = ah->pkt_memory_[index].node_addr;
-		tt = ah->pkt_memory_[index].trip_time - initialtt;
-
-		/* find best trip time from this node to dest */
-		window_t::iterator iterWin = window_.find(dest);
-		triptime_t win_tt = (*iterWin).second;
-		triptime_t::iterator itertt = win_tt.begin();
-		double mintt = (*itertt);
-		for(; itertt != win_tt.end(); itertt++) {
-			if((*itertt) < mintt)
-				mintt = (*itertt);
-		}
-		
-		/* update traffic */
-		state_t::iterator iterFind = state_.find(dest);
-		if(iterFind != state_.end()) {
-			// update existing entry
-			oldtt = (*iterFind).second.mean_tt;
-			(*iterFind).second.mean_tt = oldtt + varsigma * (tt - oldtt);
-			oldvar = (*iterFind).second.var_tt;
-			(*iterFind).second.var_tt = oldvar*oldvar + varsigma * ((tt - oldtt)*(tt - oldtt) -  oldvar*oldvar);
-			(*iterFind).second.best_tt = mintt;
-		}
-		else {
-			// add map entry
-			temp_traffic.mean_tt = tt;
-			temp_traffic.var_tt = tt;
-			temp_traffic.best_tt = mintt;
-			state_[dest] = temp_traffic;
-		}
-	}
+	/* find r */
+	double W_best = m.best_tt;
+	double I_inf = W_best;
+	double mu = m.mean_tt;
+	double sigma = sqrt(m.var_tt);
+	int w = get_win_size(dest);
+	double I_sup = mu + zee * (sigma/sqrt(w));
+	double rf = c1 * ((tt > 0.0) ? W_best/tt : 1.0);
+	double spread = (I_sup - I_inf) + (tt - I_inf);
+	if(spread > 0.0)
+		rf += c2 * ((I_sup - I_inf) / spread);
 	
-	/* find r and update pheromone */
-	for(int index = i; index < ah->pkt_mem_size(); index++) {
+	/* squash r */
+	double n = (rtable_.num_neighbors() > 0) ? rtable_.num_neighbors() : 1;
+	double s_r = 1 / (1 + exp(SQUASH_A / (((rf > 0.0) ? rf : 1e-9) * n)));
+	double s_1 = 1 / (1 + exp(SQUASH_A / n));
+	rf = s_r / s_1;
+	if(rf > MAX_ADAPTIVE_R)
+		rf = MAX_ADAPTIVE_R;
 	
-		dest = ah->pkt_memory_[index].node_addr;
-		tt = ah->pkt_memory_[index].trip_time - initialtt;
-		
-	
-		/* find r */
-		double W_best = state_[dest].best_tt;
-		double I_inf = W_best;
-		double mu = state_[dest].mean_tt;
-		double sigma = sqrt(state_[dest].var_tt);
-		int w = get_win_size(dest);
-		double I_sup = mu + zee * (sigma/sqrt(w));
-		if(I_sup == I_inf && I_inf == tt)
-			r = 0.0;
-		else
-			r = c1*(W_best/tt) + c2 * ((I_sup - I_inf) / ((I_sup - I_inf) + (tt - I_inf) ));
-		
-		if(DEBUG) {
-			printf("r = %f\n", r);
-		}
+	if(DEBUG) {
+		printf("r = %f\n", rf);
 	}
+	return rf;
+}
+
+////////////////////////////////////////////////////////////////////////////
+/// Method to check trip time budget of a forward ant.
+/// Budget is stamped by the source as kill_factor_ times its mean trip time
+/// to the destination. Ant is over budget when its trip time so far plus
+/// best known trip time from this node to the destination exceeds it.
+///////////////////////////////////////////////////////////////////////////
+bool Antnet::over_budget(Packet* p) {
+	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
+	if(ah->pkt_budget() <= 0.0)
+		return false;
+	double elapsed = CURRENT_TIME - ah->pkt_start_time();
+	const struct traffic_matrix *m = traffic_.find(ah->pkt_dst());
+	if(m != NULL)
+		elapsed += m->best_tt;
+	if(elapsed <= ah->pkt_budget())
+		return false;
+	if(DEBUG)
+		fprintf(stdout,"terminating antnet packet at %d source %d dest %d trip time %f\n", addr(), ah->pkt_src(), ah->pkt_dst(), CURRENT_TIME - ah->pkt_start_time());
+	return true;
 }
 
 //////////////////////////////////////////////////////////
@@ -487,33 +761,122 @@ void Antnet::update_traffic(Packet* p) {
 //////////////////////////////////////////////////////////
 void Antnet::update_table(Packet* p) {
 	
-	nsaddr_t dest, next;
+	nsaddr_t next;
 		
 	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);	// ant header
+	struct memory* mem = ah->pkt_memory();
 	
 	// read node visited next to this node from memory
 	// this is the nieghbor node for which routing table will be updated
-	int i;
-	for(i=0; ah->pkt_memory_[i].node_addr != addr(); i++);
-	i++;
-	next = ah->pkt_memory_[i].node_addr;
+	int i = ah->pkt_mem_cur() + 1;	// position of node after this node
+	next = mem[i].node_addr();
 	
 	if(DEBUG) {
 		fprintf(stdout,"updating ph at %d\n", addr());
 		fprintf(stdout,"next: %d\n",next);
 	}
-		
-	nsaddr_t node_addr = addr();
-	N = get_num_neighbors(node_addr);
+	
+	check_neighbor_cache();
+	
+	bool model = keep_traffic();
+	double initialtt = mem[i-1].trip_time();	// trip time to this node
 	
 	// routing table is updated for all the destination nodes that are visited after the neighbor node
 	// update pheromone value corresponding to neighbor node and destination nodes visited thereafter
+	upd_dests_.clear();
+	upd_r_.clear();
 	for(int index = i; index < ah->pkt_mem_size(); index++) {
-		// read destination nodef rom memory
-		dest = ah->pkt_memory_[index].node_addr;
-		// update pheromone valu fro neighbor node and this destination node
-		rtable_.update(dest, next);		
+		// read destination node from memory
+		nsaddr_t dest = mem[index].node_addr();
+		upd_dests_.push_back(dest);
+		if(model)
+			upd_r_.push_back(update_traffic(dest, mem[index].trip_time() - initialtt));
+	}
+	// update pheromone values for neighbor node and all these destination nodes
+	if(!upd_dests_.empty())
+		rtable_.update_batch(rtable_.slot_of(next), &upd_dests_[0], upd_dests_.size(),
+				adaptive_r_ ? &upd_r_[0] : NULL);
+}
+
+//////////////////////////////////////////////////////////
+/// Method to send an ant packet to its next hop
+/// Packet size grows with the memory the ant carries:
+/// ANT_SIZE bytes plus mem_entry_bytes_ per memory entry.
+/// Bytes sent are counted for forward and backward ants.
+//////////////////////////////////////////////////////////
+void Antnet::send_ant(Packet* p) {
+	struct hdr_cmn* ch = HDR_CMN(p);
+	struct hdr_ant_pkt* ah = HDR_ANT_PKT(p);
+	int len = ANT_SIZE + ah->pkt_mem_size() * mem_entry_bytes_;
+	ah->pkt_len() = (len < 0xffff) ? len : 0xffff;	// length of ant header
+	ch->size() = IP_HDR_LEN + len;	// packet header size
+	if(ch->direction() == hdr_cmn::UP) {
+		bwd_pkts_++;
+		bwd_bytes_ += ch->size();
+	}
+	else {
+		fwd_pkts_++;
+		fwd_bytes_ += ch->size();
+	}
+	target_->recv(p);
+}
+
+//////////////////////////////////////////////////////////
+/// Method to release an ant packet
+/// Memory of the ant goes back to the pool, unless the packet
+/// is still referenced elsewhere (then it is only unreferenced)
+//////////////////////////////////////////////////////////
+void Antnet::free_ant(Packet* p) {
+	if(p->ref_count() != 0) {
+		Packet::free(p);
+		return;
 	}
+	HDR_ANT_PKT(p)->release_memory();
+	// keep packet for next forward ant
+	if(!ant_packet_pool::instance().put(p))
+		Packet::free(p);
+}
+
+//////////////////////////////////////////////////////////
+/// Method to return pool of ant packets
+//////////////////////////////////////////////////////////
+ant_packet_pool& ant_packet_pool::instance() {
+	static ant_packet_pool pool;
+	return pool;
+}
+
+//////////////////////////////////////////////////////////
+/// Method to set maximum number of packets in the pool
+//////////////////////////////////////////////////////////
+void ant_packet_pool::set_max(int max) {
+	max_ = (max > 0) ? max : 0;
+	while(free_.size() > max_) {
+		Packet::free(free_.back());
+		free_.pop_back();
+	}
+}
+
+//////////////////////////////////////////////////////////
+/// Method to print statistics of the pool
+//////////////////////////////////////////////////////////
+void ant_packet_pool::stats(char *buf, int len) const {
+	if(max_ == 0) {
+		snprintf(buf, len, "disabled");
+		return;
+	}
+	double total = hits_ + misses_;
+	snprintf(buf, len, "hits %.0f misses %.0f hit_rate %f high_water %u size %u",
+		hits_, misses_, (total > 0) ? hits_ / total : 0.0, high_water_, (unsigned int)free_.size());
+}
+
+//////////////////////////////////////////////////////////
+/// Method to drop an ant packet
+/// Memory of the ant goes back to the pool
+//////////////////////////////////////////////////////////
+void Antnet::drop_ant(Packet* p, const char* reason) {
+	if(HDR_CMN(p)->ptype() == PT_ANT && p->ref_count() == 0)	// not still held elsewhere
+		HDR_ANT_PKT(p)->release_memory();
+	drop(p, reason);
 }
 
 //////////////////////////////////////////////////////////
@@ -523,23 +886,18 @@ void Antnet::initialize_rtable() {
 	//NUM_NODES = num_nodes_x_ * num_nodes_y_;
 	NUM_NODES = num_nodes_;		// set number of nodes in topology (read from tcl script)
 	r = r_factor_;	// set reinforcement factor (read from tcl script)
-	nsaddr_t node_addr = addr();
-	int num_nb = get_num_neighbors(node_addr);
-	Node *nd = nd->get_node_by_address(addr());
+	int num_nb = nb_.size();
+	rtable_.set_fenwick_degree(fenwick_degree_);	// high degree nodes use Fenwick rows
+	rtable_.set_dest_floor(dest_floor_);	// used once destination weights are set
 	// add destination entry for each node in topology
 	for(int i = 0; i < NUM_NODES; i++) {
 		if(addr() != i) {
-			// read list of neighbors
-			neighbor_list_node* nb = nd->neighbor_list_;
-			while(nb != NULL) {
-				// read node id of neighbor node
-				int neighb = nb->nodeid;
+			// read cached list of neighbors
+			for(int j = 0; j < num_nb; j++) {
 				// initialize equal pheromone value to all neighbor links
 				double phvalue = 1.0/num_nb;
 				// add routing table entry
-				rtable_.add_entry(i, neighb, phvalue);
-				// iterate in neighbor list
-				nb = nb->next;
+				rtable_.add_entry(i, nb_[j].id, phvalue);
 			}
 		}
 	}
@@ -547,6 +905,47 @@ void Antnet::initialize_rtable() {
 	fclose(fp);
 }
 
+//////////////////////////////////////////////////////////
+/// Method to build cache of neighbor nodes
+/// Walks the neighbor list of the node and looks up each neighbor
+/// node and the queue of the link to it. Node lookups and the Tcl
+/// interpreter are only used here, never on the routing path.
+/// Neighbors get the same index as their routing table column,
+/// neighbors added after start get a new column.
+/// Each queue keeps occupancy counters of this agent up to date.
+//////////////////////////////////////////////////////////
+void Antnet::build_neighbor_cache() {
+	// detach from previous queues before counters are reallocated
+	for(int j = 0; j < (int)nb_.size(); j++) {
+		nb_[j].queue->attach_occupancy(NULL);
+	}
+	node_ = Node::get_node_by_address(addr());
+	for(neighbor_list_node* nb = node_->neighbor_list_; nb != NULL; nb = nb->next) {
+		rtable_.add_neighbor(nb->nodeid);
+	}
+	int num_nb = rtable_.num_neighbors();
+	nb_.resize(num_nb);
+	nb_occ_.assign(num_nb, QueueOccupancy());
+	for(int j = 0; j < num_nb; j++) {
+		nb_[j].id = rtable_.neighbor(j);
+		nb_[j].node = Node::get_node_by_address(nb_[j].id);
+		nb_[j].queue = get_drop_queue(node_, nb_[j].node);
+		nb_occ_[j].ewma_w_ = queue_ewma_;
+		nb_[j].queue->attach_occupancy(&nb_occ_[j]);
+	}
+	nb_epoch_ = neighbor_epoch;
+}
+
+//////////////////////////////////////////////////////////
+/// Method to read occupancy of queue of link to each neighbor
+/// Returns NULL if queue heuristic is disabled
+//////////////////////////////////////////////////////////
+const QueueOccupancy* Antnet::queue_occupancy() {
+	if(!queue_heuristic_ || nb_occ_.empty())
+		return NULL;
+	return &nb_occ_[0];
+}
+
 //////////////////////////////////////////////////////////
 /// Method to print neighbors of a node
 //////////////////////////////////////////////////////////
@@ -576,6 +975,7 @@ void
 Antnet::add_Neighbor(Node *n1, Node *n2) {
 	n1->addNeighbor(n2);
 	n2->addNeighbor(n1);
+	neighbor_epoch++;	// neighbor caches of all agents are stale, rebuilt on next use
 }
 
 //////////////////////////////////////////////////////////
@@ -37,6 +37,7 @@
 #include <node.h>
 #include <packet.h>
 #include <ip.h>
+#include <flags.h>
 #include <trace.h>
 #include <timer-handler.h>
 #include <random.h>
@@ -56,9 +57,68 @@
 //#include <vector_richardson>
 #include <vector>
 #include <list>
+#include <algorithm>
 
 class Antnet;	// forward declaration
 
+////////////////////////////////////////////////////////////////////////////////////
+/// \brief Cached information about a neighbor node
+///
+/// Entries are indexed by the column of the neighbor in the routing table
+////////////////////////////////////////////////////////////////////////////////////
+struct neighbor_entry {
+	nsaddr_t id;		///< address of neighbor node
+	Node *node;		///< neighbor node
+	DropTail *queue;	///< queue of the link to neighbor node
+};
+
+////////////////////////////////////////////////////////////////////////////////////
+/// \brief Free list of ant packets shared by all Antnet agents
+///
+/// Released ants keep their headers, so fields that are the same for every ant
+/// (packet type, address type, ports) stay stamped and only per-ant fields
+/// are written again when a packet is reused.
+////////////////////////////////////////////////////////////////////////////////////
+class ant_packet_pool {
+	std::vector<Packet*> free_;	///< released ant packets
+	unsigned int max_;		///< maximum number of packets kept (0: pool disabled)
+	unsigned int high_water_;	///< largest number of packets kept
+	double hits_;			///< ants taken from the pool
+	double misses_;			///< ants allocated because the pool was empty
+	
+	ant_packet_pool() : max_(0), high_water_(0), hits_(0), misses_(0) {}
+	
+	public:
+		/// returns the pool shared by all Antnet agents
+		static ant_packet_pool& instance();
+		/// sets maximum number of packets kept, extra packets are freed
+		void set_max(int max);
+		/// returns a released ant packet, NULL if pool is empty or disabled
+		inline Packet* get() {
+			if(max_ == 0)	// disabled, nothing to count
+				return NULL;
+			if(free_.empty()) {
+				misses_++;
+				return NULL;
+			}
+			hits_++;
+			Packet *p = free_.back();
+			free_.pop_back();
+			return p;
+		}
+		/// keeps a released ant packet, returns false if pool is full
+		inline bool put(Packet *p) {
+			if(free_.size() >= max_)
+				return false;
+			free_.push_back(p);
+			if(free_.size() > high_water_)
+				high_water_ = free_.size();
+			return true;
+		}
+		/// print hits, misses, hit rate, high-water mark and size of pool ("disabled" if max is 0)
+		void stats(char *buf, int len) const;
+};
+
 ////////////////////////////////////////////////////////////////////////////////////
 /// \brief Class to implement timer for interval between generation of forward ants
 ///////////////////////////////////////////////////////////////////////////////////
@@ -83,9 +143,22 @@ class Antnet: public Agent {
 	
 	nsaddr_t ra_addr_;	///< address of the agent
 	antnet_rtable rtable_;	///< instance of routing table class
-	state_t state_;		///< local traffic model
-	window_t window_;	///< window of trip times to all destinations
+	traffic_model traffic_;	///< local traffic model and window of trip times to all destinations
 	u_int8_t ant_seq_num_;	///< sequence number for ant packets
+	Node *node_;		///< node of the agent
+	std::vector<neighbor_entry> nb_;	///< neighbors (indexed by rtable column)
+	std::vector<QueueOccupancy> nb_occ_;	///< occupancy of each neighbor queue, updated by the queue
+	int nb_epoch_;		///< neighbor_epoch when nb_ was built
+	std::vector<nsaddr_t> upd_dests_;	///< destinations collected from backward ant memory
+	std::vector<double> upd_r_;	///< reinforcement factor of each of these destinations
+	std::vector<double> inflight_;	///< time until which a forward ant to each destination is in flight
+	int ants_suppressed_;		///< forward ants not sent, all drawn destinations in flight
+	int ants_redrawn_;		///< destinations drawn again, previous one in flight
+	std::vector<nsaddr_t> targets_;	///< scratch: destinations of a multi-destination forward ant
+	double fwd_pkts_;		///< forward ants sent (each hop counts)
+	double fwd_bytes_;		///< bytes of forward ants sent
+	double bwd_pkts_;		///< backward ants sent (each hop counts)
+	double bwd_bytes_;		///< bytes of backward ants sent
 	
 
 	protected:
@@ -97,18 +170,27 @@ class Antnet: public Agent {
 		inline int& num_nodes_x() {return num_nodes_x_;}
 		inline int& num_nodes_y() {return num_nodes_y_;}
 		inline u_int8_t& ant_seq_num() {return ant_seq_num_;}
-		inline state_t& state() {return state_;}
-		inline window_t& window() {return window_;}
+		inline traffic_model& traffic() {return traffic_;}
 
 		void reset_ant_timer();		///< reset ant timer
 		void send_ant_pkt();		///< generate forward ant
+		Packet* alloc_ant();		///< allocate a forward ant, from the packet pool if possible
+		nsaddr_t pick_destination();	///< draw destination of a forward ant (-1 if suppressed)
+		void pick_targets(Packet*);	///< draw more destinations for a multi-destination forward ant
+		bool next_target(Packet*);	///< move forward ant on to its next unvisited destination
+		bool in_flight(nsaddr_t dest) const;	///< a forward ant to dest is in flight (dedup_)
 		void recv_ant_pkt(Packet*);	///< recieve an ant packet
 		void create_backward_ant_pkt(Packet*);	///< generate backward ant
 		void forward_ant_pkt(Packet*);		///< send a forward ant to next hop as per AntNet algorithm
 		void backward_ant_pkt(Packet*);		///< send a backward ant to next hop as per AntNet algorithm
+		bool backtrack(Packet*);	///< send a forward ant back from a dead end
+		void send_ant(Packet*);		///< size an ant packet by its memory, count it and send it
 		void memorize(Packet*);		///< add visited node to memory of forward ant
 		void update_table(Packet*);	///< update routing table
-		void update_traffic(Packet*);	///< update traffic model
+		double update_traffic(nsaddr_t dest, double tt);	///< update traffic model, return r for destination
+		bool over_budget(Packet*);	///< forward ant cannot reach destination within its trip time budget
+		void free_ant(Packet*);		///< release an ant packet and its memory
+		void drop_ant(Packet*, const char*);	///< drop an ant packet and release its memory
 		
 		/// print neighbors of a node
 		// implemented to test and debug
@@ -117,6 +199,17 @@ class Antnet: public Agent {
 		void add_Neighbor(Node* node1, Node* node2);
 		
 		void initialize_rtable();	///< initialize routing table
+		void build_neighbor_cache();	///< look up neighbor nodes and queues of links to them
+		/// rebuild neighbor cache if neighbors were added since it was built
+		inline void check_neighbor_cache() {
+			if(nb_epoch_ != neighbor_epoch)
+				build_neighbor_cache();
+		}
+		/// traffic model is kept (adaptive r, trip time budgets, in-flight expiry, trip time quantiles)
+		inline bool keep_traffic() const {
+			return adaptive_r_ || kill_factor_ > 0.0 || dedup_ || trip_quantiles_;
+		}
+		const QueueOccupancy* queue_occupancy();	///< occupancy per neighbor queue (NULL if heuristic disabled)
 		int get_win_size(nsaddr_t dest);///< return size of observation window
 		
 	public:
@@ -124,6 +217,21 @@ class Antnet: public Agent {
 		// default values defined in ns-default.tcl
 		double r_factor_;	///< reinforcement factors
 		double timer_ant_;	///< interval between generation of forward ants
+		int queue_heuristic_;	///< use queue lengths as local heuristic when choosing next hop
+		double queue_ewma_;	///< weight of averaged queue length in heuristic (0: instantaneous length)
+		int fenwick_degree_;	///< number of neighbors above which routing table rows use Fenwick trees
+		double mem_lease_;	///< time after which memory of an ant lost outside Antnet is reclaimed
+		int ant_pool_max_;	///< maximum number of released ant packets kept for reuse (0: no pool)
+		double kill_factor_;	///< trip time budget of forward ants as multiple of mean trip time (0: no budget)
+		int dedup_;		///< do not send a forward ant to a destination another ant is in flight to
+		double dedup_timeout_;	///< longest time a forward ant is considered in flight
+		int ant_targets_;	///< number of destinations of each forward ant
+		int max_backtracks_;	///< times a forward ant may go back from a dead end (0: released at dead end)
+		int mem_entry_bytes_;	///< bytes on the wire per ant memory entry (0: fixed ANT_SIZE)
+		int win_len_;		///< maximum length of observation window (trip times per destination)
+		int adaptive_r_;	///< reinforcement factor computed per destination from traffic model
+		int trip_quantiles_;	///< keep traffic model (and trip time quantiles) even if nothing else needs it
+		double dest_floor_;	///< share of destinations drawn uniformly when traffic weights are set
 		int num_nodes_;		///< total number ofnodes in topology
 		int num_nodes_x_;	///< number of nodes in row (only for regular mesh topology)
 		int num_nodes_y_;	///< number of nodes in column (only for regular mesh topology)
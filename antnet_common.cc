@@ -31,31 +31,103 @@
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #include "antnet_common.h"
+#include "ant_pkt.h"
 
-//////////////////////////////////////////////////////
-/// Method to return number of neighbors of a node
-//////////////////////////////////////////////////////
-int
-get_num_neighbors(nsaddr_t node_addr) {
-	int count = 0;
-	Node *nd = nd->get_node_by_address(node_addr);
-	neighbor_list_node* nb = nd->neighbor_list_;
-	while(nb != NULL) {
-		count ++;
-		nb = nb->next;
-	}	
-	return count;
-}
+int neighbor_epoch;	///< incremented on every add-neighbor
 
 //////////////////////////////////////////////////////////////
-/// Method to return queue length of link between two nodes
+/// Method to return drop-tail queue of link between two nodes
+/// Goes through the Tcl interpreter, agents call it once per
+/// neighbor and keep the handle
 /////////////////////////////////////////////////////////////
-int
-get_queue_length(Node *node1, Node *node2) {
+DropTail*
+get_drop_queue(Node *node1, Node *node2) {
 	Tcl& tcl = Tcl::instance();
 	// get-drop-queue method implemented in ns-lib.tcl
 	tcl.evalf("[Simulator instance] get-drop-queue %d %d", node1->nodeid(), node2->nodeid());
-	DropTail *qa = (DropTail*)TclObject::lookup(tcl.result());
-	int len = qa->getlength();
-	return len;
+	return (DropTail*)TclObject::lookup(tcl.result());
+}
+
+//////////////////////////////////////////////////////////////
+/// Method to return pool of ant memories
+/////////////////////////////////////////////////////////////
+ant_memory_pool&
+ant_memory_pool::instance() {
+	static ant_memory_pool pool;
+	return pool;
+}
+
+//////////////////////////////////////////////////////////////
+/// Method to allocate an ant memory from the pool
+/////////////////////////////////////////////////////////////
+void
+ant_memory_pool::alloc(u_int32_t &id, u_int32_t &gen) {
+	if(free_.empty() && entries_.size() >= sweep_size_)
+		sweep();
+	if(free_.empty()) {
+		entries_.push_back(entry());
+		free_.push_back(entries_.size() - 1);
+	}
+	id = free_.back();
+	free_.pop_back();
+	entry &e = entries_[id];
+	if(e.seen.empty() || e.seen_count > 0) {
+		e.seen.assign(e.seen.empty() ? ANT_SEEN_INIT : e.seen.size(), -1);	// clear visited set
+		e.seen_pos.assign(e.seen.size(), -1);
+		e.seen_count = 0;
+	}
+	e.excluded.clear();
+	entries_[id].used = true;
+	entries_[id].stamp = CURRENT_TIME;
+	gen = entries_[id].gen;
+}
+
+//////////////////////////////////////////////////////////////
+/// Method to return an ant memory to the pool
+/// Stale handles are ignored
+/////////////////////////////////////////////////////////////
+void
+ant_memory_pool::release(u_int32_t id, u_int32_t gen) {
+	if(id >= entries_.size() || entries_[id].gen != gen || !entries_[id].used)
+		return;
+	entries_[id].used = false;
+	entries_[id].gen++;
+	free_.push_back(id);
+}
+
+//////////////////////////////////////////////////////////////
+/// Method to double the visited set of an entry
+/// Only nodes still in the first size entries of memory are kept
+/////////////////////////////////////////////////////////////
+void
+ant_memory_pool::grow_seen(entry &e, int size) {
+	std::vector<nsaddr_t> old(e.seen);
+	std::vector<int> old_pos(e.seen_pos);
+	e.seen.assign(2 * old.size(), -1);
+	e.seen_pos.assign(e.seen.size(), -1);
+	e.seen_count = 0;
+	for(unsigned int i = 0; i < old.size(); i++) {
+		int pos = old_pos[i];
+		if(old[i] == -1 || pos >= size || e.mem[pos].node_addr() != old[i])
+			continue;
+		int j = seen_slot(e, old[i]);
+		e.seen[j] = old[i];
+		e.seen_pos[j] = pos;
+		e.seen_count++;
+	}
+}
+
+//////////////////////////////////////////////////////////////
+/// Method to reclaim memories of ants that were dropped
+/// outside Antnet (not touched for lease period).
+/// Runs only when the pool has doubled since the last sweep.
+/////////////////////////////////////////////////////////////
+void
+ant_memory_pool::sweep() {
+	double now = CURRENT_TIME;
+	for(u_int32_t id = 0; id < entries_.size(); id++) {
+		if(entries_[id].used && now - entries_[id].stamp > lease_)
+			release(id, entries_[id].gen);
+	}
+	sweep_size_ = 2 * entries_.size();
 }
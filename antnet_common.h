@@ -50,15 +50,12 @@
 /// Macro to retrieve current simulator time 
 #define CURRENT_TIME Scheduler::instance().clock()
 
-/// Maximum number of nodes in topology
-#define MAX_NUM_NODES 16
-
 /// file name in which routing tables generated by AntNet are dumped
 #define file_rtable "rtable.txt"
 
 #define DEBUG 0
 
-/// maximum length of observation window
+/// maximum length of observation window (default of win_len_ in ns-default.tcl)
 #define WIN_LEN 300
 /// AntNet parameters
 #define VARSIGMA 0.005
@@ -66,11 +63,15 @@
 #define c1 0.7
 #define c2 0.3
 #define zee 1.7
+#define SQUASH_A 10.0	///< squash function parameter for adaptive r
+#define MAX_ADAPTIVE_R 0.9	///< largest adaptive r (1 would wipe out other links)
+/// destinations drawn before a forward ant is suppressed (in-flight deduplication)
+#define DEDUP_DRAWS 3
 
-/// Method to return number of neighbors of a node
-int get_num_neighbors(nsaddr_t node_addr);
+/// Method to return drop-tail queue of a link between two nodes
+DropTail* get_drop_queue(Node *node1, Node *node2);
 
-/// Method to return queue length of a link between two nodes
-int get_queue_length(Node *node1, Node *node2);
+/// Incremented whenever a neighbor is added, to invalidate per-agent neighbor caches
+extern int neighbor_epoch;
  
 #endif
@@ -31,11 +31,270 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "antnet_rtable.h"
+#include <algorithm>
+
+// SSE2/AVX2 row kernels need per-function target attributes (gcc 4.9 and later),
+// ANTNET_NO_SIMD keeps the scalar kernels only
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+	&& (defined(__x86_64__) || defined(__i386__)) && !defined(ANTNET_NO_SIMD)
+#define ANTNET_X86_SIMD 1
+#include <immintrin.h>
+#endif
 
 double r;	///< reinforcement factor (value read from tcl script)
-int N;		///< Number of neighbors of a node
 int NUM_NODES;	///< number of nodes in topology
 
+/// queue length used by the local heuristic: averaged if the queue keeps an average
+static inline double queue_length(const QueueOccupancy &occ) {
+	return (occ.ewma_w_ > 0.0) ? occ.ewma_pkts_ : occ.pkts_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Kernels over one row of the pheromone matrix
+/// - sum: returns sum of n values
+/// - scale: multiplies n values by s (evaporation, normalization)
+/// - blend: out = a*ph + b - c*q (pheromone blended with queue heuristic)
+/// .
+/// All variants add in the same order (four interleaved partial sums, then
+/// the tail), so a run draws the same next hops whichever variant the CPU
+/// gets. scale and blend work on each value alone.
+////////////////////////////////////////////////////////////////////////////////
+struct row_kernels {
+	double (*sum)(const double *v, int n);
+	void (*scale)(double *v, int n, double s);
+	void (*blend)(double *out, const double *ph, const double *q, int n, double a, double b, double c);
+};
+
+static double sum_scalar(const double *v, int n) {
+	double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+	int j = 0;
+	for(; j + 4 <= n; j += 4) {
+		s0 += v[j];
+		s1 += v[j + 1];
+		s2 += v[j + 2];
+		s3 += v[j + 3];
+	}
+	double sum = (s0 + s1) + (s2 + s3);
+	for(; j < n; j++) {
+		sum += v[j];
+	}
+	return sum;
+}
+
+static void scale_scalar(double *v, int n, double s) {
+	for(int j = 0; j < n; j++) {
+		v[j] *= s;
+	}
+}
+
+static void blend_scalar(double *out, const double *ph, const double *q, int n, double a, double b, double c) {
+	for(int j = 0; j < n; j++) {
+		out[j] = a*ph[j] + b - c*q[j];
+	}
+}
+
+#ifdef ANTNET_X86_SIMD
+__attribute__((target("sse2")))
+static double sum_sse2(const double *v, int n) {
+	__m128d lo = _mm_setzero_pd(), hi = _mm_setzero_pd();
+	int j = 0;
+	for(; j + 4 <= n; j += 4) {
+		lo = _mm_add_pd(lo, _mm_loadu_pd(v + j));
+		hi = _mm_add_pd(hi, _mm_loadu_pd(v + j + 2));
+	}
+	double tmp[4];
+	_mm_storeu_pd(tmp, lo);
+	_mm_storeu_pd(tmp + 2, hi);
+	double sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+	for(; j < n; j++) {
+		sum += v[j];
+	}
+	return sum;
+}
+
+__attribute__((target("sse2")))
+static void scale_sse2(double *v, int n, double s) {
+	__m128d vs = _mm_set1_pd(s);
+	int j = 0;
+	for(; j + 2 <= n; j += 2) {
+		_mm_storeu_pd(v + j, _mm_mul_pd(_mm_loadu_pd(v + j), vs));
+	}
+	for(; j < n; j++) {
+		v[j] *= s;
+	}
+}
+
+__attribute__((target("sse2")))
+static void blend_sse2(double *out, const double *ph, const double *q, int n, double a, double b, double c) {
+	__m128d va = _mm_set1_pd(a), vb = _mm_set1_pd(b), vc = _mm_set1_pd(c);
+	int j = 0;
+	for(; j + 2 <= n; j += 2) {
+		__m128d x = _mm_add_pd(_mm_mul_pd(va, _mm_loadu_pd(ph + j)), vb);
+		_mm_storeu_pd(out + j, _mm_sub_pd(x, _mm_mul_pd(vc, _mm_loadu_pd(q + j))));
+	}
+	for(; j < n; j++) {
+		out[j] = a*ph[j] + b - c*q[j];
+	}
+}
+
+__attribute__((target("avx2")))
+static double sum_avx2(const double *v, int n) {
+	__m256d acc = _mm256_setzero_pd();
+	int j = 0;
+	for(; j + 4 <= n; j += 4) {
+		acc = _mm256_add_pd(acc, _mm256_loadu_pd(v + j));
+	}
+	double tmp[4];
+	_mm256_storeu_pd(tmp, acc);
+	double sum = (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]);
+	for(; j < n; j++) {
+		sum += v[j];
+	}
+	return sum;
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(double *v, int n, double s) {
+	__m256d vs = _mm256_set1_pd(s);
+	int j = 0;
+	for(; j + 4 <= n; j += 4) {
+		_mm256_storeu_pd(v + j, _mm256_mul_pd(_mm256_loadu_pd(v + j), vs));
+	}
+	for(; j < n; j++) {
+		v[j] *= s;
+	}
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(double *out, const double *ph, const double *q, int n, double a, double b, double c) {
+	__m256d va = _mm256_set1_pd(a), vb = _mm256_set1_pd(b), vc = _mm256_set1_pd(c);
+	int j = 0;
+	for(; j + 4 <= n; j += 4) {
+		__m256d x = _mm256_add_pd(_mm256_mul_pd(va, _mm256_loadu_pd(ph + j)), vb);
+		_mm256_storeu_pd(out + j, _mm256_sub_pd(x, _mm256_mul_pd(vc, _mm256_loadu_pd(q + j))));
+	}
+	for(; j < n; j++) {
+		out[j] = a*ph[j] + b - c*q[j];
+	}
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Kernels for rows of a fixed degree K, fully unrolled at compile time
+/// - total: sum of values of a row, excluding column pslot
+/// - search: column of the range u falls into, skipping column pslot
+///   (-1 if u is beyond the total through rounding)
+////////////////////////////////////////////////////////////////////////////////
+struct fixed_row_ops {
+	double (*total)(const double *ph, int pslot);
+	int (*search)(const double *ph, int pslot, double u);
+};
+
+template<int J, int K>
+struct fixed_row_unroll {
+	static inline double total(const double *ph, int pslot) {
+		return (J == pslot ? 0.0 : ph[J]) + fixed_row_unroll<J + 1, K>::total(ph, pslot);
+	}
+	static inline int search(const double *ph, int pslot, double u) {
+		if(J != pslot) {
+			if(u < ph[J])
+				return J;
+			u -= ph[J];
+		}
+		return fixed_row_unroll<J + 1, K>::search(ph, pslot, u);
+	}
+};
+
+template<int K>
+struct fixed_row_unroll<K, K> {
+	static inline double total(const double *, int) {return 0.0;}
+	static inline int search(const double *, int, double) {return -1;}
+};
+
+template<int K>
+static double fixed_total(const double *ph, int pslot) {
+	return fixed_row_unroll<0, K>::total(ph, pslot);
+}
+
+template<int K>
+static int fixed_search(const double *ph, int pslot, double u) {
+	return fixed_row_unroll<0, K>::search(ph, pslot, u);
+}
+
+/// specialized kernels, indexed by degree
+static const fixed_row_ops fixed_rows[MAX_FIXED_DEGREE + 1] = {
+	{NULL, NULL},
+	{NULL, NULL},
+	{fixed_total<2>, fixed_search<2>},
+	{fixed_total<3>, fixed_search<3>},
+	{fixed_total<4>, fixed_search<4>},
+};
+
+/// returns row kernels for this CPU, chosen on first use
+static const row_kernels& kernels() {
+	static row_kernels k;
+	static bool selected = false;
+	if(!selected) {
+		row_kernels scalar = {sum_scalar, scale_scalar, blend_scalar};
+		k = scalar;
+#ifdef ANTNET_X86_SIMD
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			row_kernels avx2 = {sum_avx2, scale_avx2, blend_avx2};
+			k = avx2;
+		}
+		else if(__builtin_cpu_supports("sse2")) {
+			row_kernels sse2 = {sum_sse2, scale_sse2, blend_sse2};
+			k = sse2;
+		}
+#endif
+		selected = true;
+	}
+	return k;
+}
+
+///////////////////////////////////////////////////
+/// Method to add a neighbor column to routing table
+/// Existing rows are widened, new column starts with zero pheromone
+/// Returns column of the neighbor
+///////////////////////////////////////////////////
+int antnet_rtable::add_slot(nsaddr_t neighbor) {
+	int rows = dest_of_.size();
+	std::vector<double> temp(rows * (degree_ + 1), 0.0);
+	for(int i = 0; i < rows; i++) {
+		for(int j = 0; j < degree_; j++) {
+			temp[i * (degree_ + 1) + j] = ph_[i * degree_ + j];
+		}
+	}
+	ph_.swap(temp);
+	cum_.resize(ph_.size());
+	qlen_.resize(degree_ + 1);
+	prob_.resize(degree_ + 1);
+	dirty_.assign(rows, 1);
+	nb_.push_back(neighbor);
+	if(neighbor >= (nsaddr_t)slot_of_.size())
+		slot_of_.resize(neighbor + 1, -1);
+	slot_of_[neighbor] = degree_++;
+	select_row_kind();
+	return degree_ - 1;
+}
+
+///////////////////////////////////////////////////
+/// Method to add a destination row to routing table
+/// Returns row index of the destination
+///////////////////////////////////////////////////
+int antnet_rtable::add_row(nsaddr_t dest) {
+	if(dest >= (nsaddr_t)row_of_.size())
+		row_of_.resize(dest + 1, -1);
+	row_of_[dest] = dest_of_.size();
+	dest_of_.push_back(dest);
+	scale_.push_back(1.0);
+	ph_.resize(dest_of_.size() * degree_, 0.0);
+	cum_.resize(ph_.size());
+	dirty_.push_back(1);
+	return row_of_[dest];
+}
+
 ///////////////////////////////////////////////////
 /// Method to add an entry in routing table
 /// Parameters:
@@ -44,19 +303,99 @@ int NUM_NODES;	///< number of nodes in topology
 /// - pheromone value
 ///////////////////////////////////////////////////
 void antnet_rtable::add_entry(nsaddr_t dest, nsaddr_t next, double phvalue) {
-	struct pheromone temp_pheromone;	// create new pheromone structure
-	temp_pheromone.neighbor = next;		// set neighbor node address
-	temp_pheromone.phvalue = phvalue;	// set pheromone value
-	rtable_t::iterator iterRt = rt_.find(dest);
-	if(iterRt == rt_.end()) {	// destination entry not in rtable, add new entry
-		pheromone_matrix temp;
-		temp.push_back(temp_pheromone);
-		rt_[dest] = temp;
+	int slot = find_slot(next);
+	if(slot < 0)	// neighbor not in rtable, add new column
+		slot = add_slot(next);
+	if(find_row(dest) == NULL)	// destination entry not in rtable, add new row
+		add_row(dest);
+	ph_[row_of_[dest] * degree_ + slot] = phvalue / scale_[row_of_[dest]];
+	dirty_[row_of_[dest]] = 1;
+}
+
+///////////////////////////////////////////////////
+/// Method to renormalize a row
+/// Folds scale of the row into its pheromone values
+/// and brings their sum back to one
+///////////////////////////////////////////////////
+void antnet_rtable::renormalize(int row) {
+	const row_kernels &k = kernels();
+	double *ph = &ph_[row * degree_];
+	double sum = k.sum(ph, degree_);
+	k.scale(ph, degree_, (sum > 0.0) ? 1.0/sum : scale_[row]);
+	scale_[row] = 1.0;
+	dirty_[row] = 1;
+}
+
+///////////////////////////////////////////////////
+/// Method to set degree above which rows use Fenwick trees
+/// 0 keeps cumulative arrays for any degree
+///////////////////////////////////////////////////
+void antnet_rtable::set_fenwick_degree(int degree) {
+	fenwick_degree_ = degree;
+	select_row_kind();
+	dirty_.assign(dest_of_.size(), 1);
+}
+
+///////////////////////////////////////////////////
+/// Method to choose row implementation for number of neighbors
+/// - specialized kernels for small fixed degrees
+/// - Fenwick trees above the Fenwick threshold
+/// - cumulative arrays otherwise
+///////////////////////////////////////////////////
+void antnet_rtable::select_row_kind() {
+	fixed_ = (degree_ <= MAX_FIXED_DEGREE && fixed_rows[degree_].total != NULL) ? &fixed_rows[degree_] : NULL;
+	fenwick_ = (fixed_ == NULL && fenwick_degree_ > 0 && degree_ > fenwick_degree_);
+}
+
+///////////////////////////////////////////////////
+/// Method to rebuild cumulative pheromone values of a row
+/// Called lazily by calc_next, only after the row has changed.
+/// Values are left unscaled, the draw does not depend on the row scale.
+/// With Fenwick rows, the tree is built in place in O(degree).
+///////////////////////////////////////////////////
+void antnet_rtable::build_cumulative(int row) {
+	const double *ph = &ph_[row * degree_];
+	double *cum = &cum_[row * degree_];
+	if(fenwick_) {
+		for(int j = 0; j < degree_; j++) {
+			cum[j] = ph[j];
+		}
+		for(int i = 1; i <= degree_; i++) {
+			int parent = i + (i & (-i));
+			if(parent <= degree_)
+				cum[parent - 1] += cum[i - 1];
+		}
 	}
-	else {	// destination entry exists in rtable, add neighbor entry
-		pheromone_matrix *temp = &((*iterRt).second);
-		temp->push_back(temp_pheromone);
+	else {
+		double sum = 0.0;
+		for(int j = 0; j < degree_; j++) {
+			sum += ph[j];
+			cum[j] = sum;
+		}
 	}
+	dirty_[row] = 0;
+}
+
+///////////////////////////////////////////////////
+/// Method to find the column a random value falls into
+/// Returns first column whose cumulative value exceeds u
+/// (degree_ if u is beyond the total of the row)
+///////////////////////////////////////////////////
+int antnet_rtable::row_search(const double *cum, double u) const {
+	if(!fenwick_)
+		return std::upper_bound(cum, cum + degree_, u) - cum;
+	// descend the Fenwick tree from its highest power of two
+	int step = 1;
+	while(step * 2 <= degree_)
+		step *= 2;
+	int pos = 0;
+	for(; step > 0; step /= 2) {
+		if(pos + step <= degree_ && cum[pos + step - 1] <= u) {
+			pos += step;
+			u -= cum[pos - 1];
+		}
+	}
+	return pos;
 }
 
 ///////////////////////////////////////////////////
@@ -65,10 +404,13 @@ void antnet_rtable::add_entry(nsaddr_t dest, nsaddr_t next, double phvalue) {
 void antnet_rtable::print() {
 	FILE *fp = fopen(file_rtable,"a");
 	fprintf(fp,"\tdest\tnext\tphvalue\n");
-	for(rtable_t::iterator iter = rt_.begin(); iter != rt_.end(); iter++) {
-		pheromone_matrix vect_pheromone = (*iter).second;
-		for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
-			fprintf(fp,"\t%d \t%d \t%f \n", (*iter).first, (*iterPh).neighbor, (*iterPh).phvalue);
+	for(nsaddr_t dest = 0; dest < (nsaddr_t)row_of_.size(); dest++) {
+		double *row = find_row(dest);
+		if(row == NULL)
+			continue;
+		double s = scale_[row_of_[dest]];
+		for(int j = 0; j < degree_; j++) {
+			fprintf(fp,"\t%d \t%d \t%f \n", dest, nb_[j], s * row[j]);
 		}
 	}
 	fclose(fp);
@@ -76,8 +418,21 @@ void antnet_rtable::print() {
 
 //////////////////////////////////////////////////////////////////////
 /// Method to return a randomly chosen destination for a source node
+/// Without destination weights, destinations are uniform. With weights,
+/// a share dest_floor_ is still uniform and the rest is drawn by weight
+/// from an alias table in O(1).
 /////////////////////////////////////////////////////////////////////
 nsaddr_t antnet_rtable::calc_destination(nsaddr_t source) {
+	if(!dest_w_.empty() && rnum->uniform(1.0) >= dest_floor_) {
+		if(alias_source_ != source)
+			build_alias(source);
+		if(!alias_.empty()) {
+			int i = rnum->uniform((int)alias_.size());
+			nsaddr_t dest = (rnum->uniform(1.0) < alias_prob_[i]) ? i : alias_[i];
+			if(dest != source)	// source is only left over by rounding
+				return dest;
+		}
+	}
 	int tmp_int;
 	do {
 		tmp_int = rnum->uniform(NUM_NODES);
@@ -86,6 +441,67 @@ nsaddr_t antnet_rtable::calc_destination(nsaddr_t source) {
 	return tmp_int;
 }
 
+//////////////////////////////////////////////////////////////////////
+/// Method to set traffic weight of a destination
+/////////////////////////////////////////////////////////////////////
+void antnet_rtable::set_dest_weight(nsaddr_t dest, double weight) {
+	if(dest < 0)
+		return;
+	if(dest >= (nsaddr_t)dest_w_.size())
+		dest_w_.resize(dest + 1, 0.0);
+	dest_w_[dest] = (weight > 0.0) ? weight : 0.0;
+	alias_source_ = -1;	// rebuild alias table on next draw
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Method to build alias table of destination weights (Vose)
+/// Source node and nodes beyond NUM_NODES get no weight (weights may be
+/// set before the number of nodes is known). Table is left empty if no
+/// other destination has a weight.
+/////////////////////////////////////////////////////////////////////
+void antnet_rtable::build_alias(nsaddr_t source) {
+	int n = std::min((int)dest_w_.size(), NUM_NODES);
+	alias_source_ = source;
+	alias_.clear();
+	alias_prob_.clear();
+	double total = 0.0;
+	for(int i = 0; i < n; i++) {
+		if(i != source)
+			total += dest_w_[i];
+	}
+	if(total <= 0.0)
+		return;
+	alias_.resize(n);
+	alias_prob_.resize(n);
+	std::vector<int> small, large;
+	for(int i = 0; i < n; i++) {
+		alias_[i] = i;
+		alias_prob_[i] = (i != source) ? dest_w_[i] * n / total : 0.0;	// scaled to mean 1
+		if(alias_prob_[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while(!small.empty() && !large.empty()) {
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		alias_[s] = l;		// rest of column s goes to l
+		alias_prob_[l] -= 1.0 - alias_prob_[s];
+		if(alias_prob_[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// columns left over are full up to rounding
+	for(unsigned int i = 0; i < large.size(); i++) {
+		alias_prob_[large[i]] = 1.0;
+	}
+	for(unsigned int i = 0; i < small.size(); i++) {
+		if(small[i] != source)
+			alias_prob_[small[i]] = 1.0;
+	}
+}
+
 //////////////////////////////////////////////////////////////////////
 /// Method to implement AntNet algorithm
 /// Returns next hop node address
@@ -93,95 +509,175 @@ nsaddr_t antnet_rtable::calc_destination(nsaddr_t source) {
 /// - source node address
 /// - destination node address
 /// - parent node (to avoid loopback)
+/// .
+/// Next hop is drawn in proportion to pheromone values, excluding the parent link.
+/// The probability range of the parent link is cut out of the draw, so a single
+/// random number and a binary search over the cumulative row (or a descent of its
+/// Fenwick tree) are enough.
 /////////////////////////////////////////////////////////////////////
 nsaddr_t antnet_rtable::calc_next(nsaddr_t source, nsaddr_t dest, nsaddr_t parent) {
-	nsaddr_t next, nextn;
-	double thisph;
-	double thisqueue;
-	double thisprob;
-	double maxprob = 0.0;
-	double maxph = 0.0;
-	double lrange = 0.0, urange = 0.0;
-	// find routing table entry for destination node
-	rtable_t::iterator iter = rt_.find(dest);
-	double qtotal = 0.0;
 	if(DEBUG) 
 		fprintf(stdout,"in calc_next at source %d dest %d parent %d\n",source,dest,parent);
-	if(iter != rt_.end()) {
-		pheromone_matrix vect_pheromone;
-	
-		if(DEBUG) {
-			vect_pheromone = (*iter).second;
-			fprintf(stdout,"neighbors of %d:\t",source);
-			for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
-				fprintf(stdout,"%d\t%f\t",(*iterPh).neighbor, (*iterPh).phvalue);
-			}
-			fprintf(stdout,"\n");
-		}
-
-		// read vector of pheromone values for the destination node
-		vect_pheromone = (*iter).second;
-		for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
-			next = (*iterPh).neighbor;
-			Node *node1 = node1->get_node_by_address(source);
-			Node *node2 = node2->get_node_by_address(next);
-			int temp_len = get_queue_length(node1,node2);
-			qtotal += temp_len;
-		}
-		if(qtotal == 0.0) {
-			qtotal = 1.0;
-		}
-		
-		// calculate probability range for parent link
-		lrange = 0.0;
-		urange = 0.0;
-		for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
-			thisph = (*iterPh).phvalue;
-			next = (*iterPh).neighbor;
-			Node *node1 = node1->get_node_by_address(source);
-			Node *node2 = node2->get_node_by_address(next);
-			int thisqueue = get_queue_length(node1,node2);
-			thisprob = (thisph + ALPHA*(1 - thisqueue/qtotal)) / (1 + ALPHA*(N-1));
-			//thisprob = thisph;
-			if(next == parent) {
-				urange = lrange + (thisph);
-				break;
-			}
-			lrange += (thisph);
+	// find routing table entry for destination node
+	if(find_row(dest) == NULL || degree_ == 0)
+		return parent;
+	int row = row_of_[dest];
+	if(DEBUG) {
+		fprintf(stdout,"neighbors of %d:\t",source);
+		for(int j = 0; j < degree_; j++) {
+			fprintf(stdout,"%d\t%f\t",nb_[j], scale_[row] * ph_[row * degree_ + j]);
 		}
-		if(urange == 0.0)
-			urange = 1.0;
-		
-		// dead end, loopback
-		if(lrange == 0.0 && urange == 1.0) {
-		//	printf("return parent %d\n",parent);
+		fprintf(stdout,"\n");
+	}
+	
+	int pslot = find_slot(parent);
+	if(fixed_ != NULL) {
+		// draw straight from pheromone values, parent link left out
+		const double *ph = &ph_[row * degree_];
+		double total = fixed_->total(ph, pslot);
+		if(total <= 0.0)	// dead end, loopback
 			return parent;
+		int j = fixed_->search(ph, pslot, rnum->uniform(total));
+		if(j < 0)	// rounding at the top of the range
+			j = (pslot == degree_ - 1) ? degree_ - 2 : degree_ - 1;
+		return nb_[j];
+	}
+	
+	const double *cum = cumulative(row);
+	double total = row_prefix(cum, degree_);
+	
+	// probability range of parent link [lrange, lrange + parentph)
+	double lrange = 0.0, parentph = 0.0;
+	if(pslot >= 0) {
+		lrange = row_prefix(cum, pslot);
+		parentph = ph_[row * degree_ + pslot];
+	}
+	
+	// dead end, loopback
+	if(total - parentph <= 0.0) {
+		return parent;
+	}
+	
+	// generate random probability value, skipping range of parent link
+	double tmp_double = rnum->uniform(total - parentph);
+	if(pslot >= 0 && tmp_double >= lrange)
+		tmp_double += parentph;
+	
+	// find next hop node corresponding to this range of probability
+	int j = row_search(cum, tmp_double);
+	if(j >= degree_)	// rounding at the top of the range
+		j = (pslot == degree_ - 1) ? degree_ - 2 : degree_ - 1;
+	return nb_[j];
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Method to implement AntNet algorithm with local heuristic
+/// Returns next hop node address
+/// Parameters:
+/// - source node address
+/// - destination node address
+/// - parent node (to avoid loopback)
+/// - occupancy of the queue of the link to each neighbor column
+/// .
+/// Probability of a link is (ph + ALPHA*(1 - q/qtotal)) / (1 + ALPHA*(N-1)).
+/// Queue lengths change all the time, so this draw scans the row.
+/// The averaged queue length is used when the queue keeps one.
+/////////////////////////////////////////////////////////////////////
+nsaddr_t antnet_rtable::calc_next(nsaddr_t source, nsaddr_t dest, nsaddr_t parent, const QueueOccupancy *occ) {
+	if(occ == NULL)
+		return calc_next(source, dest, parent);
+	if(find_row(dest) == NULL || degree_ == 0)
+		return parent;
+	
+	// probability of each link, none for parent link
+	fill_prob(row_of_[dest], occ);
+	int pslot = find_slot(parent);
+	if(pslot >= 0)
+		prob_[pslot] = 0.0;
+	return draw_prob(parent);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Method to implement AntNet algorithm leaving some neighbors out
+/// Returns next hop node address
+/// Parameters:
+/// - source node address
+/// - destination node address
+/// - parent node (to avoid loopback)
+/// - occupancy of the queue of the link to each neighbor column (NULL: pheromone only)
+/// - neighbors that are not to be chosen, and their number
+/// .
+/// Used by backtracking ants, scans the row.
+/////////////////////////////////////////////////////////////////////
+nsaddr_t antnet_rtable::calc_next(nsaddr_t source, nsaddr_t dest, nsaddr_t parent, const QueueOccupancy *occ, const nsaddr_t *excluded, int num_excluded) {
+	if(num_excluded <= 0)
+		return calc_next(source, dest, parent, occ);
+	if(find_row(dest) == NULL || degree_ == 0)
+		return parent;
+	
+	fill_prob(row_of_[dest], occ);
+	int pslot = find_slot(parent);
+	if(pslot >= 0)
+		prob_[pslot] = 0.0;
+	for(int i = 0; i < num_excluded; i++) {
+		int slot = find_slot(excluded[i]);
+		if(slot >= 0)
+			prob_[slot] = 0.0;
+	}
+	return draw_prob(parent);
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Method to fill next hop probability of each column of a row
+/// Probability is the pheromone value, blended with queue lengths of
+/// the links if occupancy is given
+/////////////////////////////////////////////////////////////////////
+void antnet_rtable::fill_prob(int row, const QueueOccupancy *occ) {
+	const row_kernels &k = kernels();
+	const double *ph = &ph_[row * degree_];
+	double s = scale_[row];
+	if(occ == NULL) {
+		for(int j = 0; j < degree_; j++) {
+			prob_[j] = s * ph[j];
 		}
-		
-		// generate random probability value, out of range of parent link
-		double tmp_double;
-		do {
-			tmp_double = rnum->uniform(1.0);
-		}while(tmp_double >= lrange && tmp_double < urange);
-
-		// find next hop node corresponding to this range of probability
-		lrange = 0.0;
-		urange = 0.0;
-		for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
-			thisph = (*iterPh).phvalue;
-			next = (*iterPh).neighbor;
-			Node *node1 = node1->get_node_by_address(source);
-			Node *node2 = node2->get_node_by_address(next);
-			int thisqueue = get_queue_length(node1,node2);
-			thisprob = (thisph + ALPHA*(1 - thisqueue/qtotal)) / (1 + ALPHA*(N-1));
-			urange += (thisph);
-			if(tmp_double >= lrange && tmp_double < urange) {
-				//printf("return next %d\n",next);
-				return next;
-			}
-			lrange = urange;
-		}
+		return;
+	}
+	for(int j = 0; j < degree_; j++) {
+		qlen_[j] = queue_length(occ[j]);
 	}
+	double qtotal = k.sum(&qlen_[0], degree_);
+	if(qtotal == 0.0) {
+		qtotal = 1.0;
+	}
+	double norm = 1 + ALPHA*(degree_-1);
+	k.blend(&prob_[0], ph, &qlen_[0], degree_, s/norm, ALPHA/norm, ALPHA/(qtotal*norm));
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Method to draw a neighbor from next hop probabilities
+/// Returns parent if no neighbor has a probability (dead end)
+/////////////////////////////////////////////////////////////////////
+nsaddr_t antnet_rtable::draw_prob(nsaddr_t parent) {
+	double total = kernels().sum(&prob_[0], degree_);
+	
+	// dead end, loopback
+	if(total <= 0.0) {
+		return parent;
+	}
+	
+	// find next hop node corresponding to random probability value
+	double tmp_double = rnum->uniform(total);
+	int last = -1;
+	double urange = 0.0;
+	for(int j = 0; j < degree_; j++) {
+		if(prob_[j] <= 0.0)
+			continue;
+		urange += prob_[j];
+		last = j;
+		if(tmp_double < urange)
+			return nb_[j];
+	}
+	return (last >= 0) ? nb_[last] : parent;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -194,20 +690,29 @@ nsaddr_t antnet_rtable::calc_next(nsaddr_t source, nsaddr_t dest, nsaddr_t paren
 ///////////////////////////////////////////////////////////////////////////////////
 void antnet_rtable::update(nsaddr_t dest, nsaddr_t next) {
 	
-	pheromone_matrix *vect_pheromone;
-	pheromone_matrix temp;
-	
-	// read ruoitng table entry for destination
-	rtable_t::iterator iterRt = rt_.find(dest);
-	if(iterRt != rt_.end()) {
-		vect_pheromone = &((*iterRt).second);
-		pheromone_matrix::iterator iterPh = vect_pheromone->begin();
-		for(; iterPh != vect_pheromone->end(); iterPh++) {
-			double oldph = (*iterPh).phvalue;
-			if((*iterPh).neighbor == next)
-				(*iterPh).phvalue = oldph + r*(1 - oldph); // increase ph value for link travelled by ant
-			else
-				(*iterPh).phvalue = (1-r)*oldph;	// evaporate pheromone for other links
-		}
+	// read routing table entry for destination
+	int slot = find_slot(next);
+	if(find_row(dest) != NULL && slot >= 0) {
+		reinforce(row_of_[dest], slot, r);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+/// Method to update routing table for all destinations carried by a backward ant
+/// Parameters:
+/// - column of neighbor node travelled by the ant
+/// - destination node addresses
+/// - number of destinations
+/// - reinforcement factor of each destination (NULL: global r)
+/// .
+/// Same increment and evaporation as update(), applied to every destination row
+/// in a single pass without looking up the neighbor again for each row
+///////////////////////////////////////////////////////////////////////////////////
+void antnet_rtable::update_batch(int slot, const nsaddr_t *dests, int num_dests, const double *rfactors) {
+	if(slot < 0)
+		return;
+	for(int i = 0; i < num_dests; i++) {
+		if(find_row(dests[i]) != NULL)
+			reinforce(row_of_[dests[i]], slot, (rfactors != NULL) ? rfactors[i] : r);
 	}
 }
@@ -43,34 +43,137 @@
 #include "ant_pkt.h"
 #include "antnet_common.h"
 
-////////////////////////////////////////////////////////////////////////////////////////////////
-/// \brief Represents an entry in routing table
-///
-/// This structure represents pheromone value corresponding to a neighbor node
-////////////////////////////////////////////////////////////////////////////////////////////////
-struct pheromone {
-	nsaddr_t neighbor;	///< address of neighbor node
-	double phvalue;		///< pheromone value
-};
+extern double r;	///< reinforcement factor
 
-/// vector of pheromone values (represents entry in routing table corresponding to a destination)
-typedef std::vector<struct pheromone> pheromone_matrix;
-/// Routing table
-typedef std::map<nsaddr_t, pheromone_matrix> rtable_t;
 /// Vector of neighbors all having same and maximum pheromone value
 typedef std::vector<nsaddr_t> sameph_t;
 
+/// Row scale below which a row is renormalized (folded into its pheromone values)
+#define MIN_ROW_SCALE 1e-20
+/// Largest degree with rows specialized at compile time
+#define MAX_FIXED_DEGREE 4
+
+struct fixed_row_ops;	// forward declaration
+
 /////////////////////////////////////////////////////////////
 /// \brief Class to implement routing table
+///
+/// The table is stored as one dense pheromone matrix: a row per destination
+/// and a column per neighbor. Destination addresses are mapped to rows through
+/// a flat index, neighbor addresses are kept apart from the pheromone values,
+/// so looking up an entry costs one index calculation and a scan of one row.
+///
+/// Evaporation is lazy: the pheromone value of an entry is the stored value
+/// times the scale of its row. Evaporating a row only multiplies its scale,
+/// so a reinforcement touches the scale and the winning entry. Rows are
+/// renormalized when their scale drops below MIN_ROW_SCALE.
+///
+/// Next hops are drawn from cumulative pheromone values of a row. For nodes
+/// with more neighbors than the Fenwick threshold, these are kept in a Fenwick
+/// (binary indexed) tree per row instead, so both a draw and a reinforcement
+/// cost O(log degree). Nodes with 2 to MAX_FIXED_DEGREE neighbors (regular
+/// meshes) draw straight from the pheromone values with kernels unrolled for
+/// their degree, and need no cumulative values at all.
 /////////////////////////////////////////////////////////////
 class antnet_rtable {
-	rtable_t rt_;	///< routing table
+	std::vector<int> row_of_;	///< row index of each destination (-1 if no entry)
+	std::vector<nsaddr_t> dest_of_;	///< destination address of each row
+	std::vector<nsaddr_t> nb_;	///< neighbor address of each column
+	std::vector<int> slot_of_;	///< column of each neighbor address (-1 if not a neighbor)
+	std::vector<double> ph_;	///< pheromone values (unscaled), row-major (num rows x degree_)
+	std::vector<double> scale_;	///< scale of each row
+	std::vector<double> cum_;	///< cumulative values (or Fenwick tree) of each row, same layout as ph_
+	std::vector<char> dirty_;	///< set when a row changed since its cumulative values were built
+	std::vector<double> qlen_;	///< scratch: queue length per column
+	std::vector<double> prob_;	///< scratch: next hop probability per column
+	int degree_;			///< number of columns (neighbors)
+	int fenwick_degree_;		///< degree above which rows use Fenwick trees (0: never)
+	bool fenwick_;			///< rows use Fenwick trees
+	const fixed_row_ops *fixed_;	///< kernels specialized for degree_ (NULL if none)
+	std::vector<double> dest_w_;	///< traffic weight of each destination (empty: uniform destinations)
+	std::vector<double> alias_prob_;	///< alias table: probability of keeping each column
+	std::vector<nsaddr_t> alias_;	///< alias table: alias of each column
+	nsaddr_t alias_source_;		///< source node the alias table was built for (-1: rebuild)
+	double dest_floor_;		///< share of destinations drawn uniformly when weighted
 	
 	RNG *rnum;	///< random number generator
+	
+	/// returns first pheromone value of the row for destination, NULL if no entry
+	inline double* find_row(nsaddr_t dest) {
+		if(dest < 0 || dest >= (nsaddr_t)row_of_.size() || row_of_[dest] < 0)
+			return NULL;
+		return &ph_[row_of_[dest] * degree_];
+	}
+	/// returns column of neighbor node, -1 if not a neighbor
+	inline int find_slot(nsaddr_t neighbor) const {
+		if(neighbor < 0 || neighbor >= (nsaddr_t)slot_of_.size())
+			return -1;
+		return slot_of_[neighbor];
+	}
+	/// returns cumulative pheromone values of a row, rebuilt if the row changed
+	inline const double* cumulative(int row) {
+		if(dirty_[row])
+			build_cumulative(row);
+		return &cum_[row * degree_];
+	}
+	void build_cumulative(int row);		///< rebuild cumulative values (or Fenwick tree) of a row
+	/// returns sum of the first n (unscaled) values of a row
+	inline double row_prefix(const double *cum, int n) const {
+		if(!fenwick_)
+			return (n > 0) ? cum[n - 1] : 0.0;
+		double sum = 0.0;
+		for(; n > 0; n -= n & (-n)) {
+			sum += cum[n - 1];
+		}
+		return sum;
+	}
+	/// returns first column of a row whose cumulative value exceeds u
+	int row_search(const double *cum, double u) const;
+	/// adds delta to a column of the Fenwick tree of a row
+	inline void fenwick_add(int row, int slot, double delta) {
+		double *cum = &cum_[row * degree_];
+		for(int i = slot + 1; i <= degree_; i += i & (-i)) {
+			cum[i - 1] += delta;
+		}
+	}
+	void renormalize(int row);		///< fold scale of a row into its values
+	/// reinforce a neighbor column of a row by rf and evaporate the others
+	inline void reinforce(int row, int slot, double rf) {
+		double *ph = &ph_[row * degree_];
+		double s = scale_[row];
+		double oldv = ph[slot];
+		double oldph = s * oldv;
+		double winner = oldph + rf*(1 - oldph);	// increase ph value for link travelled by ant
+		s = (1-rf) * s;	// evaporate pheromone for all links
+		if(s < MIN_ROW_SCALE) {
+			// fold the new scale into the values instead of dividing by it
+			// (with rf = 1 the winner gets 1 and the others 0)
+			for(int j = 0; j < degree_; j++) {
+				ph[j] *= s;
+			}
+			ph[slot] = winner;
+			scale_[row] = 1.0;
+			renormalize(row);
+			return;
+		}
+		ph[slot] = winner / s;
+		scale_[row] = s;
+		if(fenwick_ && !dirty_[row])
+			fenwick_add(row, slot, ph[slot] - oldv);	// only the winning entry changed
+		else
+			dirty_[row] = 1;
+	}
+	void select_row_kind();		///< choose row implementation for degree_
+	void build_alias(nsaddr_t source);	///< build alias table of destination weights
+	void fill_prob(int row, const QueueOccupancy *occ);	///< next hop probability per column into prob_
+	nsaddr_t draw_prob(nsaddr_t parent);	///< draw a neighbor from prob_ (parent if none)
+	int add_slot(nsaddr_t neighbor);	///< add a neighbor column
+	int add_row(nsaddr_t dest);		///< add a destination row
+	
 	public:
 
 		/// Constructor
-		antnet_rtable() {
+		antnet_rtable() : degree_(0), fenwick_degree_(0), fenwick_(false), fixed_(NULL), alias_source_(-1), dest_floor_(1.0) {
 			rnum = new RNG((long int)CURRENT_TIME);
 		}
 		
@@ -84,9 +187,40 @@ class antnet_rtable {
 		/// returns next hop node for given source destination pair
 		// Parameters: source node, destination node, parent node
 		nsaddr_t calc_next(nsaddr_t source, nsaddr_t destination, nsaddr_t parent);
+		/// returns next hop node, blending pheromone with queue lengths of the links
+		// Parameters: source node, destination node, parent node, queue occupancy per neighbor column
+		nsaddr_t calc_next(nsaddr_t source, nsaddr_t destination, nsaddr_t parent, const QueueOccupancy *occ);
+		/// returns next hop node other than the excluded neighbors
+		// Parameters: source node, destination node, parent node, queue occupancy per neighbor column (may be NULL),
+		// excluded neighbor nodes, number of excluded neighbors
+		nsaddr_t calc_next(nsaddr_t source, nsaddr_t destination, nsaddr_t parent, const QueueOccupancy *occ,
+				const nsaddr_t *excluded, int num_excluded);
 		/// updates an entry in routing table
 		// Parameters: destination node, neighbor node
 		void update(nsaddr_t destination, nsaddr_t neighbor);
+		/// updates entries of a neighbor for several destinations in one pass
+		// Parameters: neighbor column, destination nodes, number of destinations,
+		// reinforcement factor of each destination (NULL: global r for all)
+		void update_batch(int slot, const nsaddr_t *destinations, int num_dests, const double *rfactors = NULL);
+		
+		/// adds a neighbor column if not present, returns its column
+		inline int add_neighbor(nsaddr_t neighbor) {
+			int slot = find_slot(neighbor);
+			return (slot >= 0) ? slot : add_slot(neighbor);
+		}
+		/// sets degree above which rows use Fenwick trees (0: never)
+		void set_fenwick_degree(int degree);
+		/// sets traffic weight of a destination, destinations are then drawn by weight
+		void set_dest_weight(nsaddr_t destination, double weight);
+		/// sets share of destinations drawn uniformly when weights are set
+		inline void set_dest_floor(double floor) {dest_floor_ = floor;}
+		
+		/// returns number of neighbor columns
+		inline int num_neighbors() const {return degree_;}
+		/// returns column of a neighbor node, -1 if not a neighbor
+		inline int slot_of(nsaddr_t neighbor) const {return find_slot(neighbor);}
+		/// returns neighbor address of a column
+		inline nsaddr_t neighbor(int slot) const {return nb_[slot];}
 };
 
 #endif
@@ -33,15 +33,250 @@
 #include <vector>
 #include <classifier-port.h>
 #include <random.h>
+#include <algorithm>
+#include <memory>
 
-typedef std::vector<double> triptime_t;
-typedef std::map<nsaddr_t, triptime_t> window_t;
+/////////////////////////////////////////////////////////////
+/// \brief Observation window of trip times to a destination
+///
+/// Keeps the last capacity trip times in a ring buffer. The minimum
+/// is kept by a monotonic deque of sample numbers whose trip times
+/// increase from front to back, so a new sample and the minimum
+/// cost O(1) (amortized).
+/////////////////////////////////////////////////////////////
+class triptime_t {
+	std::vector<double> buf_;	///< trip times, sample n at n % capacity
+	std::vector<unsigned int> dq_;	///< ring of sample numbers, trip times increasing
+	unsigned int next_;		///< number of next sample
+	unsigned int dq_head_;		///< position of deque front in dq_
+	unsigned int dq_size_;		///< number of sample numbers in deque
+	
+	inline double at(unsigned int n) const {return buf_[n % buf_.size()];}
+	inline unsigned int& dq(unsigned int i) {return dq_[(dq_head_ + i) % dq_.size()];}
+	
+	public:
+		/// Constructor, window of at most capacity trip times
+		triptime_t(int capacity = 1) : buf_(capacity > 0 ? capacity : 1), dq_(buf_.size()), next_(0), dq_head_(0), dq_size_(0) {}
+		
+		/// adds a trip time, dropping the oldest if window is full
+		inline void push_back(double tt) {
+			unsigned int cap = buf_.size();
+			if(dq_size_ > 0 && next_ - dq(0) >= cap) {	// front leaves the window
+				dq_head_ = (dq_head_ + 1) % cap;
+				dq_size_--;
+			}
+			while(dq_size_ > 0 && at(dq(dq_size_ - 1)) >= tt) {
+				dq_size_--;
+			}
+			buf_[next_ % cap] = tt;
+			dq(dq_size_++) = next_++;
+		}
+		/// returns smallest trip time in window (0 if empty)
+		inline double min() const {
+			return (dq_size_ > 0) ? at(dq_[dq_head_]) : 0.0;
+		}
+		/// returns number of trip times in window
+		inline int size() const {
+			return (next_ < buf_.size()) ? next_ : buf_.size();
+		}
+};
+
+/////////////////////////////////////////////////////////////
+/// \brief Streaming estimate of a quantile of trip times
+///
+/// P-square algorithm (Jain and Chlamtac, 1985): five markers whose
+/// heights follow the minimum, p/2, p, (1+p)/2 quantiles and maximum
+/// are adjusted with a parabolic formula on every sample. Constant
+/// memory, no samples are stored.
+/////////////////////////////////////////////////////////////
+class p2_quantile {
+	double p_;		///< quantile (0 < p < 1)
+	double q_[5];		///< marker heights
+	double np_[5];		///< desired marker positions
+	int n_[5];		///< marker positions
+	int count_;		///< number of samples seen
+	
+	/// parabolic prediction of height of marker i moved by d
+	inline double parabolic(int i, int d) const {
+		return q_[i] + (double)d / (n_[i+1] - n_[i-1]) *
+			((n_[i] - n_[i-1] + d) * (q_[i+1] - q_[i]) / (n_[i+1] - n_[i]) +
+			 (n_[i+1] - n_[i] - d) * (q_[i] - q_[i-1]) / (n_[i] - n_[i-1]));
+	}
+	
+	public:
+		p2_quantile(double p = 0.5) : p_(p), count_(0) {}
+		
+		/// adds a sample
+		inline void add(double x) {
+			if(count_ < 5) {	// first samples are kept as they are
+				q_[count_++] = x;
+				if(count_ == 5) {
+					std::sort(q_, q_ + 5);
+					for(int i = 0; i < 5; i++) {
+						n_[i] = i;
+					}
+					np_[0] = 0; np_[1] = 2*p_; np_[2] = 4*p_; np_[3] = 2 + 2*p_; np_[4] = 4;
+				}
+				return;
+			}
+			count_++;
+			// cell of the sample, extremes are replaced
+			int k;
+			if(x < q_[0]) {
+				q_[0] = x;
+				k = 0;
+			}
+			else if(x >= q_[4]) {
+				q_[4] = x;
+				k = 3;
+			}
+			else {
+				for(k = 0; x >= q_[k+1]; k++);
+			}
+			for(int i = k + 1; i < 5; i++) {
+				n_[i]++;
+			}
+			np_[1] += p_/2; np_[2] += p_; np_[3] += (1 + p_)/2; np_[4] += 1;
+			// move middle markers that are off their desired positions
+			for(int i = 1; i <= 3; i++) {
+				double d = np_[i] - n_[i];
+				if((d >= 1 && n_[i+1] - n_[i] > 1) || (d <= -1 && n_[i-1] - n_[i] < -1)) {
+					int s = (d > 0) ? 1 : -1;
+					double qp = parabolic(i, s);
+					if(q_[i-1] < qp && qp < q_[i+1])
+						q_[i] = qp;
+					else	// linear
+						q_[i] += s * (q_[i+s] - q_[i]) / (n_[i+s] - n_[i]);
+					n_[i] += s;
+				}
+			}
+		}
+		/// returns estimated quantile (0 if no samples)
+		inline double value() const {
+			if(count_ >= 5)
+				return q_[2];
+			if(count_ == 0)
+				return 0.0;
+			double tmp[5];
+			std::copy(q_, q_ + count_, tmp);
+			std::sort(tmp, tmp + count_);
+			return tmp[(int)(p_ * (count_ - 1) + 0.5)];
+		}
+};
+
+/// Streaming trip time quantiles of one destination
+struct trip_quantiles {
+	p2_quantile p50;	///< median
+	p2_quantile p95;	///< 95th percentile
+	p2_quantile p99;	///< 99th percentile
+	trip_quantiles() : p50(0.50), p95(0.95), p99(0.99) {}
+};
 
+/// Size of a cache line, alignment of the traffic model array
+#define CACHE_LINE 64
+
+/////////////////////////////////////////////////////////////
+/// \brief Allocator of storage aligned to a cache line
+///
+/// Over-allocates by a cache line and keeps the address of the
+/// block just below the aligned address, to free it.
+/////////////////////////////////////////////////////////////
+template<class T>
+struct cache_aligned_allocator : public std::allocator<T> {
+	template<class U> struct rebind {typedef cache_aligned_allocator<U> other;};
+	
+	cache_aligned_allocator() {}
+	cache_aligned_allocator(const cache_aligned_allocator&) : std::allocator<T>() {}
+	template<class U> cache_aligned_allocator(const cache_aligned_allocator<U>&) {}
+	
+	/// returns storage for n objects, aligned to CACHE_LINE
+	T* allocate(size_t n, const void* = 0) {
+		char *raw = (char*)::operator new(n * sizeof(T) + sizeof(void*) + CACHE_LINE - 1);
+		size_t addr = (size_t)(raw + sizeof(void*));
+		char *p = raw + sizeof(void*) + (CACHE_LINE - addr % CACHE_LINE) % CACHE_LINE;
+		((void**)p)[-1] = raw;
+		return (T*)p;
+	}
+	/// frees storage returned by allocate()
+	void deallocate(T *p, size_t) {
+		::operator delete(((void**)p)[-1]);
+	}
+};
+
+/// Traffic model of one destination (32 bytes, two entries per cache line
+/// in the cache-aligned array of traffic_model)
 struct traffic_matrix {
-	double mean_tt;
-	double var_tt;
-	double best_tt;
+	double mean_tt;		///< exponential average of trip time
+	double var_tt;		///< exponential variance of trip time
+	double best_tt;		///< best trip time in observation window
+	int count;		///< number of trip times seen (0: no model)
+};
+
+/////////////////////////////////////////////////////////////
+/// \brief Local traffic model of a node
+///
+/// Traffic model, observation window and trip time quantiles of each
+/// destination are held in dense arrays indexed by destination address.
+/////////////////////////////////////////////////////////////
+class traffic_model {
+	std::vector<struct traffic_matrix, cache_aligned_allocator<struct traffic_matrix> > state_;	///< traffic model per destination
+	std::vector<triptime_t> window_;	///< observation window per destination
+	std::vector<trip_quantiles> quant_;	///< trip time quantiles per destination
+	int win_len_;				///< capacity of new observation windows
+	
+	public:
+		traffic_model() : win_len_(1) {}
+		
+		/// sets capacity of observation windows created from now on
+		inline void set_win_len(int len) {win_len_ = len;}
+		/// returns traffic model of a destination, NULL if none
+		inline const struct traffic_matrix* find(nsaddr_t dest) const {
+			if(dest < 0 || dest >= (nsaddr_t)state_.size() || state_[dest].count == 0)
+				return NULL;
+			return &state_[dest];
+		}
+		/// returns trip time quantiles of a destination, NULL if none
+		inline const trip_quantiles* quantiles(nsaddr_t dest) const {
+			if(find(dest) == NULL)
+				return NULL;
+			return &quant_[dest];
+		}
+		/// returns number of trip times in observation window of a destination
+		inline int win_size(nsaddr_t dest) const {
+			return (dest >= 0 && dest < (nsaddr_t)window_.size()) ? window_[dest].size() : 0;
+		}
+		/// adds a trip time to a destination, returns its updated model
+		// Mean and variance are exponential averages with weight varsigma,
+		// updated incrementally (Welford style): d = tt - mean, mean += varsigma*d,
+		// var = (1-varsigma)*(var + varsigma*d*d)
+		inline const struct traffic_matrix& update(nsaddr_t dest, double tt, double varsigma) {
+			if(dest >= (nsaddr_t)state_.size()) {
+				struct traffic_matrix none = {0.0, 0.0, 0.0, 0};
+				state_.resize(dest + 1, none);
+				window_.resize(dest + 1, triptime_t(win_len_));
+				quant_.resize(dest + 1);
+			}
+			triptime_t &win = window_[dest];
+			win.push_back(tt);
+			trip_quantiles &tq = quant_[dest];
+			tq.p50.add(tt);
+			tq.p95.add(tt);
+			tq.p99.add(tt);
+			struct traffic_matrix &m = state_[dest];
+			if(m.count == 0) {
+				m.mean_tt = tt;
+				m.var_tt = 0.0;
+			}
+			else {
+				double d = tt - m.mean_tt;
+				double incr = varsigma * d;
+				m.mean_tt += incr;
+				m.var_tt = (1 - varsigma) * (m.var_tt + d * incr);
+			}
+			m.best_tt = win.min();
+			m.count++;
+			return m;
+		}
 };
-typedef std::map<nsaddr_t, struct traffic_matrix> state_t;
 
 #endif
@@ -0,0 +1,80 @@
+/*
+ * kernel_bench.cc
+ *
+ * Benchmark of the routing table row kernels for degrees 4 to 64: updates
+ * (evaporation and renormalization) and next hop draws blended with queue
+ * lengths (queue sum, blend and probability sum). Built twice by the
+ * Makefile, with the SSE2/AVX2 kernels chosen at run time (kernel_bench)
+ * and with the scalar kernels only (kernel_bench_scalar).
+ *
+ * The checksum of the draws does not depend on the kernels: both builds
+ * must print the same checksums.
+ *
+ * usage: kernel_bench [operations]
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \file kernel_bench.cc
+/// \brief Routing table kernel benchmark for degrees 4 to 64
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <sys/time.h>
+#include "antnet_rtable.h"
+
+/// number of destination rows
+#define BENCH_DESTS 256
+
+/// returns wall clock time in seconds
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/// times updates and blended draws for one degree
+static void bench(int degree, int ops) {
+	antnet_rtable rt;
+	// neighbors are nodes 1..degree
+	for(int d = 0; d < BENCH_DESTS; d++) {
+		for(int j = 1; j <= degree; j++) {
+			rt.add_entry(d, j, 1.0 / degree);
+		}
+	}
+	std::vector<QueueOccupancy> occ(degree);
+	RNG rng(12345);
+	std::vector<nsaddr_t> dest(ops), next(ops), parent(ops);
+	std::vector<int> qslot(ops), qlen(ops);
+	for(int i = 0; i < ops; i++) {
+		dest[i] = rng.uniform(BENCH_DESTS);
+		next[i] = 1 + rng.uniform(degree);
+		parent[i] = 1 + rng.uniform(degree);
+		qslot[i] = rng.uniform(degree);
+		qlen[i] = rng.uniform(50);
+	}
+
+	double t0 = now();
+	for(int i = 0; i < ops; i++) {
+		rt.update(dest[i], next[i]);
+	}
+	double t1 = now();
+	unsigned long check = 0;
+	for(int i = 0; i < ops; i++) {
+		occ[qslot[i]].pkts_ = qlen[i];	// one queue changes between draws
+		check = check * 31 + rt.calc_next(0, dest[i], parent[i], &occ[0]);
+	}
+	double t2 = now();
+	printf("%6d | %8.1f %10.2f | %8.1f %10.2f | %08lx\n", degree,
+			(t1 - t0) * 1e9 / ops, ops / (t1 - t0) * 1e-6,
+			(t2 - t1) * 1e9 / ops, ops / (t2 - t1) * 1e-6, check & 0xffffffffUL);
+}
+
+int main(int argc, char **argv) {
+	int ops = (argc > 1) ? atoi(argv[1]) : 1000000;
+	r = 0.3;
+	printf("%d destinations, %d operations\n", BENCH_DESTS, ops);
+	printf("%6s | %8s %10s | %8s %10s | %8s\n", "degree", "upd ns", "upd M/s", "nxt ns", "nxt M/s", "checksum");
+	for(int degree = 4; degree <= 64; degree *= 2) {
+		bench(degree, ops);
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * ns-bench.h
+ *
+ * Minimal stand-ins for the ns-2 declarations used by the AntNet routing
+ * table, so that antnet_rtable.cc can be built outside the simulator for
+ * the benchmarks in bench/. Only declarations are given here, except for
+ * the random number generator and scheduler defined in stubs.cc.
+ */
+
+#ifndef __ns_bench_h__
+#define __ns_bench_h__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef int nsaddr_t;
+typedef unsigned char u_int8_t;
+typedef unsigned short u_int16_t;
+typedef unsigned int u_int32_t;
+typedef int packet_t;
+static const packet_t PT_ANT = 62;
+
+class TclObject {
+public:
+	virtual ~TclObject() {}
+	virtual int command(int argc, const char*const* argv);
+	void bind(const char *var, int *val);
+	void bind(const char *var, double *val);
+	void bind_bool(const char *var, int *val);
+};
+class Event { public: double time_; };
+class Handler { public: virtual ~Handler() {} virtual void handle(Event*) {} };
+class Scheduler { public: static Scheduler& instance(); double clock() const; };
+class Packet : public Event {
+public:
+	unsigned char *bits_;
+	Packet *next_;
+	static Packet* alloc();
+	static void free(Packet *p);
+	unsigned char* access(int off) const { return bits_ + off; }
+};
+class NsObject : public TclObject, public Handler { public: virtual void recv(Packet *p, Handler *h = 0) = 0; };
+class Connector : public NsObject { public: void recv(Packet *p, Handler *h); };
+class Agent : public Connector {};
+class Node : public TclObject { public: static Node* get_node_by_address(nsaddr_t addr); };
+class TimerHandler : public Handler {};
+class Trace : public Connector {};
+class BaseTrace;
+class MobileNode;
+class PortClassifier : public NsObject {};
+class RNG { public: RNG(long seed); double uniform(double r); int uniform(int r); };
+class PacketQueue { public: int length() const; int byteLength() const; void enque(Packet *p); Packet* deque(); };
+class Queue : public Connector {
+protected:
+	virtual void reset();
+	int command(int argc, const char*const* argv);
+	virtual void enque(Packet *p) = 0;
+	virtual Packet* deque() = 0;
+	PacketQueue *pq_;
+	int qlim_;
+};
+
+#endif
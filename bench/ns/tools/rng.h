@@ -0,0 +1 @@
+#include "../ns-bench.h"
@@ -0,0 +1,183 @@
+/*
+ * rtable_bench.cc
+ *
+ * Microbenchmark of the AntNet routing table: the dense pheromone matrix of
+ * antnet_rtable against the std::map<nsaddr_t, pheromone_matrix> table it
+ * replaced, for 16, 256 and 4096 destinations.
+ *
+ * usage: rtable_bench [operations]
+ */
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \file rtable_bench.cc
+/// \brief Routing table microbenchmark: dense matrix vs std::map
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include <sys/time.h>
+#include "antnet_rtable.h"
+
+/////////////////////////////////////////////////////////////
+/// \brief Routing table as it was before the dense matrix
+///
+/// std::map keyed by destination, holding a vector of
+/// {neighbor, pheromone} pairs. update() and calc_next() are
+/// those of the original table, without the queue lengths
+/// that calc_next() read (and then ignored) for every link.
+/////////////////////////////////////////////////////////////
+class map_rtable {
+	struct pheromone {
+		nsaddr_t neighbor;	///< neighbor node
+		double phvalue;		///< pheromone value
+	};
+	typedef std::vector<pheromone> pheromone_matrix;
+	typedef std::map<nsaddr_t, pheromone_matrix> rtable_t;
+
+	rtable_t rt_;	///< routing table
+	RNG *rnum;	///< random number generator
+
+	public:
+		map_rtable() { rnum = new RNG(0); }
+
+		void add_entry(nsaddr_t dest, nsaddr_t next, double phvalue) {
+			pheromone ph;
+			ph.neighbor = next;
+			ph.phvalue = phvalue;
+			rt_[dest].push_back(ph);
+		}
+
+		nsaddr_t calc_next(nsaddr_t source, nsaddr_t dest, nsaddr_t parent) {
+			double lrange = 0.0, urange = 0.0;
+			rtable_t::iterator iter = rt_.find(dest);
+			if(iter == rt_.end())
+				return parent;
+			pheromone_matrix vect_pheromone = (*iter).second;	// copied, as in the original
+
+			// probability range of parent link
+			for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
+				if((*iterPh).neighbor == parent) {
+					urange = lrange + (*iterPh).phvalue;
+					break;
+				}
+				lrange += (*iterPh).phvalue;
+			}
+			if(urange == 0.0)
+				urange = 1.0;
+			if(lrange == 0.0 && urange == 1.0)
+				return parent;
+
+			// random probability value, out of range of parent link
+			double tmp_double;
+			do {
+				tmp_double = rnum->uniform(1.0);
+			} while(tmp_double >= lrange && tmp_double < urange);
+
+			lrange = 0.0;
+			urange = 0.0;
+			for(pheromone_matrix::iterator iterPh = vect_pheromone.begin(); iterPh != vect_pheromone.end(); iterPh++) {
+				urange += (*iterPh).phvalue;
+				if(tmp_double >= lrange && tmp_double < urange)
+					return (*iterPh).neighbor;
+				lrange = urange;
+			}
+			return parent;
+		}
+
+		void update(nsaddr_t dest, nsaddr_t next) {
+			rtable_t::iterator iterRt = rt_.find(dest);
+			if(iterRt == rt_.end())
+				return;
+			pheromone_matrix *vect_pheromone = &((*iterRt).second);
+			for(pheromone_matrix::iterator iterPh = vect_pheromone->begin(); iterPh != vect_pheromone->end(); iterPh++) {
+				double oldph = (*iterPh).phvalue;
+				if((*iterPh).neighbor == next)
+					(*iterPh).phvalue = oldph + r*(1 - oldph);
+				else
+					(*iterPh).phvalue = (1-r)*oldph;
+			}
+		}
+};
+
+static volatile long sink;	///< keeps results of calc_next() alive
+
+/// returns wall clock time in seconds
+static double now() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/// operations replayed on both tables
+struct workload {
+	std::vector<nsaddr_t> dest;	///< destination of each operation
+	std::vector<nsaddr_t> next;	///< neighbor reinforced by each update
+	std::vector<nsaddr_t> parent;	///< neighbor an ant arrived from in each draw
+};
+
+/// times updates then draws on a table, in ns per operation
+template<class T>
+static void run(T &rt, const workload &w, double &upd_ns, double &next_ns, long &check) {
+	int n = (int)w.dest.size();
+	double t0 = now();
+	for(int i = 0; i < n; i++) {
+		rt.update(w.dest[i], w.next[i]);
+	}
+	double t1 = now();
+	for(int i = 0; i < n; i++) {
+		check += rt.calc_next(0, w.dest[i], w.parent[i]);
+	}
+	double t2 = now();
+	upd_ns = (t1 - t0) * 1e9 / n;
+	next_ns = (t2 - t1) * 1e9 / n;
+}
+
+/// compares both tables for a number of destinations and neighbors
+static void bench(int num_dests, int degree, int ops) {
+	antnet_rtable dense;
+	map_rtable sparse;
+	// neighbors are nodes 1..degree, destinations 0..num_dests-1 in random insertion order
+	std::vector<nsaddr_t> order(num_dests);
+	for(int d = 0; d < num_dests; d++) {
+		order[d] = d;
+	}
+	RNG rng(12345);
+	for(int d = num_dests - 1; d > 0; d--) {
+		std::swap(order[d], order[rng.uniform(d + 1)]);
+	}
+	for(int d = 0; d < num_dests; d++) {
+		for(int j = 1; j <= degree; j++) {
+			dense.add_entry(order[d], j, 1.0 / degree);
+			sparse.add_entry(order[d], j, 1.0 / degree);
+		}
+	}
+
+	workload w;
+	for(int i = 0; i < ops; i++) {
+		w.dest.push_back(rng.uniform(num_dests));
+		w.next.push_back(1 + rng.uniform(degree));
+		w.parent.push_back(1 + rng.uniform(degree));
+	}
+
+	double dense_upd, dense_next, map_upd, map_next;
+	long check = 0;
+	run(sparse, w, map_upd, map_next, check);
+	run(dense, w, dense_upd, dense_next, check);
+	sink += check;
+	printf("%6d %6d | %8.1f %8.1f %6.2fx | %8.1f %8.1f %6.2fx\n", num_dests, degree,
+			map_upd, dense_upd, map_upd / dense_upd, map_next, dense_next, map_next / dense_next);
+}
+
+int main(int argc, char **argv) {
+	int ops = (argc > 1) ? atoi(argv[1]) : 1000000;
+	static const int dests[] = {16, 256, 4096};
+	static const int degrees[] = {4, 8};
+	r = 0.3;
+	printf("ns per operation, %d operations\n", ops);
+	printf("%6s %6s | %8s %8s %7s | %8s %8s %7s\n", "dests", "degree",
+			"map upd", "dense", "", "map nxt", "dense", "");
+	for(int i = 0; i < 3; i++) {
+		for(int j = 0; j < 2; j++) {
+			bench(dests[i], degrees[j], ops);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * stubs.cc
+ *
+ * Definitions behind the stand-in ns-2 declarations of ns-bench.h: a small
+ * xorshift generator in place of the ns-2 RNG (cheap, so that it does not
+ * dominate the timings) and a scheduler whose clock stays at zero.
+ */
+
+#include "ns-bench.h"
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+RNG::RNG(long seed) {
+	if(seed != 0)
+		rng_state = (unsigned long long)seed;
+}
+
+/// returns a uniform value in [0, r)
+double RNG::uniform(double r) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return r * ((rng_state >> 11) * (1.0 / 9007199254740992.0));
+}
+
+/// returns a uniform integer in [0, r)
+int RNG::uniform(int r) {
+	return (int)uniform((double)r);
+}
+
+static Scheduler scheduler;
+
+Scheduler& Scheduler::instance() {
+	return scheduler;
+}
+
+double Scheduler::clock() const {
+	return 0.0;
+}
@@ -50,6 +50,7 @@ static class DropTailClass : public TclClass {
 void DropTail::reset()
 {
 	Queue::reset();
+	update_occupancy();
 }
 
 int 
@@ -72,6 +73,7 @@ DropTail::command(int argc, const char*const* argv)
 				return (TCL_ERROR);
 			else {
 				pq_ = q_;
+				update_occupancy();
 				return (TCL_OK);
 			}
 		}
@@ -102,6 +104,7 @@ void DropTail::enque(Packet* p)
 	} else {
 		q_->enque(p);
 	}
+	update_occupancy();
 }
 
 //AG if queue size changes, we drop excessive packets...
@@ -123,6 +126,7 @@ void DropTail::shrink_queue()
                         drop(pp);
                 }
         }
+	update_occupancy();
 }
 
 Packet* DropTail::deque()
@@ -130,7 +134,9 @@ Packet* DropTail::deque()
         if (summarystats && &Scheduler::instance() != NULL) {
                 Queue::updateStats(qib_?q_->byteLength():q_->length());
         }
-	return q_->deque();
+	Packet *p = q_->deque();
+	update_occupancy();
+	return p;
 }
 
 int DropTail::getlength() {
@@ -41,6 +41,19 @@
 #include "queue.h"
 #include "config.h"
 
+/*
+ * Occupancy of a queue, kept up to date by the queue itself on every
+ * enque, deque and drop, so that a listener (e.g. a routing agent)
+ * can read it without polling the queue.
+ */
+struct QueueOccupancy {
+	int pkts_;		/* packets in queue */
+	int bytes_;		/* bytes in queue */
+	double ewma_pkts_;	/* exponentially weighted average of pkts_ */
+	double ewma_w_;		/* weight of new samples in ewma_pkts_ (0: off) */
+	QueueOccupancy() : pkts_(0), bytes_(0), ewma_pkts_(0.0), ewma_w_(0.0) {}
+};
+
 /*
  * A bounded, drop-tail queue
  */
@@ -49,6 +62,7 @@ class DropTail : public Queue {
 	DropTail() { 
 		q_ = new PacketQueue; 
 		pq_ = q_;
+		occ_ = 0;
 		bind_bool("drop_front_", &drop_front_);
 		bind_bool("summarystats_", &summarystats);
 		bind_bool("queue_in_bytes_", &qib_);  // boolean: q in bytes?
@@ -71,8 +85,23 @@ class DropTail : public Queue {
 	void print_summarystats();
 	int qib_;       	/* bool: queue measured in bytes? */
 	int mean_pktsize_;	/* configured mean packet size in bytes */
+	QueueOccupancy *occ_;	/* listener's occupancy counters, if any */
+	inline void update_occupancy() {
+		if (occ_) {
+			occ_->pkts_ = q_->length();
+			occ_->bytes_ = q_->byteLength();
+			if (occ_->ewma_w_ > 0.0)
+				occ_->ewma_pkts_ += occ_->ewma_w_ *
+				    (occ_->pkts_ - occ_->ewma_pkts_);
+		}
+	}
   public:
     int getlength();	
+	/* attach (or detach, with 0) occupancy counters of a listener */
+	void attach_occupancy(QueueOccupancy *occ) {
+		occ_ = occ;
+		update_occupancy();
+	}
 };
 
 #endif
@@ -1471,3 +1471,18 @@ Agent/Antnet set num_nodes_y_ 4
 Agent/Antnet set num_nodes_ 16
 Agent/Antnet set r_factor_ 0.001
 Agent/Antnet set timer_ant_ 0.03
+Agent/Antnet set queue_heuristic_ false
+Agent/Antnet set queue_ewma_ 0.0
+Agent/Antnet set fenwick_degree_ 32
+Agent/Antnet set mem_lease_ 10.0
+Agent/Antnet set ant_pool_max_ 1024
+Agent/Antnet set kill_factor_ 0.0
+Agent/Antnet set dedup_ false
+Agent/Antnet set dedup_timeout_ 0.5
+Agent/Antnet set ant_targets_ 1
+Agent/Antnet set max_backtracks_ 0
+Agent/Antnet set mem_entry_bytes_ 8
+Agent/Antnet set win_len_ 300
+Agent/Antnet set adaptive_r_ false
+Agent/Antnet set trip_quantiles_ false
+Agent/Antnet set dest_floor_ 0.1